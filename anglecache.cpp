@@ -0,0 +1,95 @@
+#include "anglecache.h"
+#include "hashing.h"
+
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace rotimage {
+
+namespace {
+
+const char magic[8] = { 'R', 'O', 'T', 'A', 'N', 'G', 'L', '1' };
+
+struct Record {
+	uint64_t key;
+	double angle;
+	double confidence;
+	int64_t lines;
+};
+
+} // namespace
+
+
+bool AngleCache::open(const std::string& path) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	bool fresh = true;
+	std::ifstream existing(path, std::ios::binary);
+	if (existing) {
+		char header[sizeof(magic)];
+		if (existing.read(header, sizeof(header))) {
+			if (memcmp(header, magic, sizeof(magic)) != 0) {
+				std::cerr << "Not an angle cache: " << path << std::endl;
+				return false;
+			}
+			fresh = false;
+
+			Record record;
+			while (existing.read((char*)&record, sizeof(record))) {
+				AngleEstimate& estimate = estimates[record.key];
+				estimate.angle = record.angle;
+				estimate.confidence = record.confidence;
+				estimate.lines = (int)record.lines;
+			}
+		}
+	}
+	existing.close();
+
+	file.open(path, fresh ? std::ios::binary | std::ios::trunc : std::ios::binary | std::ios::app);
+	if (!file) {
+		return false;
+	}
+	if (fresh) {
+		file.write(magic, sizeof(magic));
+		file.flush();
+	}
+	else {
+		// drop a torn record so new ones stay aligned
+		std::error_code ec;
+		auto size = std::filesystem::file_size(path, ec);
+		auto whole = sizeof(magic) + (size - sizeof(magic)) / sizeof(Record) * sizeof(Record);
+		if (!ec && whole != size) {
+			file.close();
+			std::filesystem::resize_file(path, whole, ec);
+			file.open(path, std::ios::binary | std::ios::app);
+		}
+	}
+	return (bool)file;
+}
+
+bool AngleCache::find(uint64_t key, AngleEstimate& estimate) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = estimates.find(key);
+	if (found == estimates.end()) {
+		return false;
+	}
+	estimate = found->second;
+	return true;
+}
+
+void AngleCache::store(uint64_t key, const AngleEstimate& estimate) {
+	std::lock_guard<std::mutex> lock(mutex);
+	estimates[key] = estimate;
+
+	Record record = { key, estimate.angle, estimate.confidence, estimate.lines };
+	file.write((const char*)&record, sizeof(record));
+	file.flush();
+}
+
+uint64_t AngleCache::key(uint64_t contentHash, const DetectorOptions& detector, bool unchanged) {
+	uint64_t parts[3] = { contentHash, hashDetector(detector), unchanged ? 1u : 0u };
+	return hashBytes(parts, sizeof(parts));
+}
+
+} // namespace rotimage
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "librotimage.h"
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// persistent cache of detected angles, so re-running with different output
+/// settings on the same inputs only pays for the warp and encode.
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+/**
+ * append-only file of fixed size records ( 8 byte key, then the angle, the
+ * confidence and the number of lines of the estimate, 8 bytes each ) behind an
+ * 8 byte magic. the key is the content hash of the encoded image combined with
+ * the detector settings and the decode mode, so changing the detector tuning
+ * never returns a stale angle. a torn record at the end, from a crash, is
+ * ignored. safe to use from multiple threads.
+ */
+class AngleCache {
+public:
+	/**
+	 * load an existing cache ( a missing one is fine ) and open it for appending.
+	 *
+	 * @param path The cache file.
+	 * @return bool False if it isn't a cache file or couldn't be written.
+	 */
+	bool open(const std::string& path);
+
+	/**
+	 * @param key From AngleCache::key().
+	 * @param estimate Receives the cached estimate.
+	 * @return bool True on a hit.
+	 */
+	bool find(uint64_t key, AngleEstimate& estimate) const;
+
+	void store(uint64_t key, const AngleEstimate& estimate);
+
+	/**
+	 * cache key for an image.
+	 *
+	 * @param contentHash Hash of the encoded image bytes.
+	 * @param detector The detector settings the angle is estimated with.
+	 * @param unchanged Options::unchanged, the detector sees other pixels of deep images with it.
+	 */
+	static uint64_t key(uint64_t contentHash, const DetectorOptions& detector, bool unchanged = false);
+
+private:
+	mutable std::mutex mutex;
+	std::unordered_map<uint64_t, AngleEstimate> estimates;
+	std::ofstream file;
+};
+
+} // namespace rotimage
@@ -0,0 +1,245 @@
+#include "anglereport.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+namespace rotimage {
+
+namespace {
+
+bool isJson(const std::string& path) {
+	std::string extension = std::filesystem::path(path).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension == ".json";
+}
+
+std::string jsonString(const std::string& text) {
+	std::string quoted = "\"";
+	for (char c : text) {
+		switch (c) {
+		case '"': quoted += "\\\""; break;
+		case '\\': quoted += "\\\\"; break;
+		case '\n': quoted += "\\n"; break;
+		case '\r': quoted += "\\r"; break;
+		case '\t': quoted += "\\t"; break;
+		default:
+			if ((unsigned char)c < 0x20) {
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+				quoted += escaped;
+			}
+			else {
+				quoted += c;
+			}
+		}
+	}
+	return quoted + "\"";
+}
+
+std::string csvString(const std::string& text) {
+	std::string quoted = "\"";
+	for (char c : text) {
+		if (c == '"') {
+			quoted += '"';
+		}
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+/**
+ * split one csv line, quotes optional since people edit these by hand.
+ */
+std::vector<std::string> splitCsv(const std::string& line) {
+	std::vector<std::string> fields(1);
+	bool quoted = false;
+	for (size_t i = 0; i < line.size(); i++) {
+		char c = line[i];
+		if (quoted) {
+			if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+				fields.back() += '"';
+				i++;
+			}
+			else if (c == '"') {
+				quoted = false;
+			}
+			else {
+				fields.back() += c;
+			}
+		}
+		else if (c == '"') {
+			quoted = true;
+		}
+		else if (c == ',') {
+			fields.emplace_back();
+		}
+		else if (c != '\r') {
+			fields.back() += c;
+		}
+	}
+	return fields;
+}
+
+bool loadCsv(const std::string& path, std::vector<AngleRecord>& records) {
+	std::ifstream file(path);
+	if (!file) {
+		return false;
+	}
+
+	std::string line;
+	size_t number = 0;
+	while (std::getline(file, line)) {
+		number++;
+		auto fields = splitCsv(line);
+		if (fields.size() < 2 || fields[0].empty() || (number == 1 && fields[0] == "path")) {
+			continue;
+		}
+		try {
+			AngleRecord record;
+			record.path = fields[0];
+			record.estimate.angle = std::stod(fields[1]);
+			// hand written reports may only have path,angle
+			if (fields.size() > 2 && !fields[2].empty()) {
+				record.estimate.confidence = std::stod(fields[2]);
+			}
+			if (fields.size() > 3 && !fields[3].empty()) {
+				record.estimate.lines = std::stoi(fields[3]);
+			}
+			records.push_back(record);
+		}
+		catch (const std::exception&) {
+			std::cerr << "Warning: Bad angle on line " << number << " of " << path << std::endl;
+		}
+	}
+	return true;
+}
+
+bool loadJson(const std::string& path, std::vector<AngleRecord>& records) {
+	try {
+		cv::FileStorage storage(path, cv::FileStorage::READ | cv::FileStorage::FORMAT_JSON);
+		if (!storage.isOpened()) {
+			return false;
+		}
+		for (const auto& image : storage["images"]) {
+			AngleRecord record;
+			record.path = (std::string)image["path"];
+			if (record.path.empty()) {
+				continue;
+			}
+			record.estimate.angle = (double)image["angle"];
+			record.estimate.confidence = (double)image["confidence"];
+			record.estimate.lines = (int)image["lines"];
+			records.push_back(record);
+		}
+	}
+	catch (const cv::Exception& e) {
+		std::cerr << "Failed to parse " << path << ": " << e.what() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+} // namespace
+
+
+AngleReportWriter::~AngleReportWriter() {
+	close();
+}
+
+bool AngleReportWriter::open(const std::string& path) {
+	std::lock_guard<std::mutex> lock(mutex);
+	json = isJson(path);
+	first = true;
+	file.open(path, std::ios::trunc);
+	if (!file) {
+		return false;
+	}
+	file.precision(10);
+	file << (json ? "{\n    \"images\": [" : "path,angle,confidence,lines\n");
+	return (bool)file;
+}
+
+void AngleReportWriter::write(const AngleRecord& record) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (json) {
+		file << (first ? "\n" : ",\n") << "        { \"path\": " << jsonString(record.path)
+			<< ", \"angle\": " << record.estimate.angle
+			<< ", \"confidence\": " << record.estimate.confidence
+			<< ", \"lines\": " << record.estimate.lines << " }";
+	}
+	else {
+		file << csvString(record.path) << ',' << record.estimate.angle << ',' << record.estimate.confidence << ',' << record.estimate.lines << '\n';
+	}
+	first = false;
+}
+
+bool AngleReportWriter::close() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!file.is_open()) {
+		return true;
+	}
+	if (json) {
+		file << "\n    ]\n}\n";
+	}
+	bool ok = (bool)file;
+	file.close();
+	return ok;
+}
+
+
+bool loadAngleRecords(const std::string& path, std::vector<AngleRecord>& records) {
+	return isJson(path) ? loadJson(path, records) : loadCsv(path, records);
+}
+
+bool loadAngleReport(const std::string& path, std::unordered_map<std::string, double>& angles) {
+	std::vector<AngleRecord> records;
+	if (!loadAngleRecords(path, records)) {
+		return false;
+	}
+	// a path listed twice ( hand edits appended at the end ) takes the last angle
+	for (const auto& record : records) {
+		angles[record.path] = record.estimate.angle;
+	}
+	return true;
+}
+
+bool mergeAngleReports(const std::vector<std::string>& inputs, const std::string& output) {
+	// sorted, so the merged report is the same whatever order the shards finished in
+	std::map<std::string, AngleRecord> merged;
+	size_t duplicates = 0;
+	for (const auto& input : inputs) {
+		std::vector<AngleRecord> records;
+		if (!loadAngleRecords(input, records)) {
+			std::cerr << "Failed to read the report: " << input << std::endl;
+			return false;
+		}
+		for (auto& record : records) {
+			if (!merged.emplace(record.path, record).second) {
+				duplicates++;
+			}
+		}
+	}
+	if (duplicates > 0) {
+		// shards only overlap when they were run with different shard counts
+		std::cerr << "Warning: " << duplicates << " images are in more than one report, keeping the first angle of each" << std::endl;
+	}
+
+	AngleReportWriter writer;
+	if (!writer.open(output)) {
+		std::cerr << "Failed to open the report: " << output << std::endl;
+		return false;
+	}
+	for (const auto& entry : merged) {
+		writer.write(entry.second);
+	}
+	if (!writer.close()) {
+		std::cerr << "Failed to write the report: " << output << std::endl;
+		return false;
+	}
+	return true;
+}
+
+} // namespace rotimage
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "librotimage.h"
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// two pass mode, detect-only writes a report of path -> angle that can be
+/// reviewed and edited, --angles-from applies it later without detecting again.
+///
+/// paths are relative to the input directory ( with / separators ) so the
+/// report still applies when the tree is mounted somewhere else.
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+struct AngleRecord {
+	std::string path;
+	AngleEstimate estimate;
+};
+
+/**
+ * writes a report as images are detected, csv unless the file name ends in
+ * .json. safe to use from multiple threads.
+ *
+ * csv   path,angle,confidence,lines
+ * json  { "images": [ { "path": ..., "angle": ..., "confidence": ..., "lines": ... } ] }
+ */
+class AngleReportWriter {
+public:
+	~AngleReportWriter();
+
+	bool open(const std::string& path);
+	void write(const AngleRecord& record);
+
+	/**
+	 * finish the report, called by the destructor if needed.
+	 *
+	 * @return bool False if anything failed to write.
+	 */
+	bool close();
+
+private:
+	std::mutex mutex;
+	std::ofstream file;
+	bool json = false;
+	bool first = true;
+};
+
+/**
+ * read every record of a report written by AngleReportWriter, in file order.
+ * confidence and lines are 0 when a hand written report leaves them out.
+ *
+ * @param path The .csv or .json report.
+ * @param records Receives the records.
+ * @return bool False if the report couldn't be read.
+ */
+bool loadAngleRecords(const std::string& path, std::vector<AngleRecord>& records);
+
+/**
+ * read a report written by AngleReportWriter, possibly edited by hand.
+ *
+ * @param path The .csv or .json report.
+ * @param angles Receives relative path -> angle.
+ * @return bool False if the report couldn't be read.
+ */
+bool loadAngleReport(const std::string& path, std::unordered_map<std::string, double>& angles);
+
+/**
+ * combine the reports written by the shards of a --shard run into one, sorted
+ * by path. csv and json can be mixed, the output format goes by its name.
+ *
+ * @param inputs The per shard reports.
+ * @param output The merged report to write.
+ * @return bool False if a report couldn't be read or the output written.
+ */
+bool mergeAngleReports(const std::vector<std::string>& inputs, const std::string& output);
+
+} // namespace rotimage
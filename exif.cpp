@@ -0,0 +1,411 @@
+#include "exif.h"
+#include "imageformat.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+namespace rotimage {
+
+namespace {
+
+const uint16_t orientationTag = 0x0112;
+const uint16_t exifPointerTag = 0x8769;
+const uint16_t pixelWidthTag = 0xA002;
+const uint16_t pixelHeightTag = 0xA003;
+
+const uint16_t typeShort = 3;
+const uint16_t typeLong = 4;
+
+/**
+ * a tiff structure in a buffer: the whole file for tiff, the payload of the
+ * exif segment or chunk for jpeg and png. every access is bounds checked, a
+ * broken file just looks like one without the tag.
+ */
+class TiffView {
+public:
+	TiffView(uchar* data, size_t size) : data(data), size(size) {
+		if (size >= 8 && memcmp(data, "II*\0", 4) == 0) {
+			little = true;
+			ok = true;
+		}
+		else if (size >= 8 && memcmp(data, "MM\0*", 4) == 0) {
+			little = false;
+			ok = true;
+		}
+	}
+
+	uint16_t get16(size_t pos) const {
+		if (pos + 2 > size) {
+			return 0;
+		}
+		return little ? (uint16_t)(data[pos] | data[pos + 1] << 8) : (uint16_t)(data[pos] << 8 | data[pos + 1]);
+	}
+
+	uint32_t get32(size_t pos) const {
+		if (pos + 4 > size) {
+			return 0;
+		}
+		return little ? (uint32_t)get16(pos) | (uint32_t)get16(pos + 2) << 16 : (uint32_t)get16(pos) << 16 | get16(pos + 2);
+	}
+
+	void put16(size_t pos, uint16_t value) {
+		if (pos + 2 > size) {
+			return;
+		}
+		data[pos + (little ? 0 : 1)] = (uchar)(value & 0xFF);
+		data[pos + (little ? 1 : 0)] = (uchar)(value >> 8);
+	}
+
+	void put32(size_t pos, uint32_t value) {
+		put16(pos + (little ? 0 : 2), (uint16_t)(value & 0xFFFF));
+		put16(pos + (little ? 2 : 0), (uint16_t)(value >> 16));
+	}
+
+	uint32_t firstIfd() const {
+		return get32(4);
+	}
+
+	/**
+	 * @return size_t Position of the 12 byte entry for tag in the IFD at ifd, 0 if it isn't there.
+	 */
+	size_t findEntry(uint32_t ifd, uint16_t tag) const {
+		if (!ok || ifd < 8 || (size_t)ifd + 2 > size) {
+			return 0;
+		}
+		uint16_t count = get16(ifd);
+		for (size_t i = 0; i < count; i++) {
+			size_t entry = ifd + 2 + 12 * i;
+			if (entry + 12 > size) {
+				return 0;
+			}
+			if (get16(entry) == tag) {
+				return entry;
+			}
+		}
+		return 0;
+	}
+
+	/**
+	 * @return size_t Position of a single SHORT or LONG value of tag in the IFD at ifd, 0 if it isn't there.
+	 */
+	size_t findValue(uint32_t ifd, uint16_t tag, uint16_t& type) const {
+		size_t entry = findEntry(ifd, tag);
+		if (entry == 0 || get32(entry + 4) != 1) {
+			return 0;
+		}
+		type = get16(entry + 2);
+		return (type == typeShort || type == typeLong) ? entry + 8 : 0;
+	}
+
+private:
+	uchar* data;
+	size_t size;
+	bool little = false;
+	bool ok = false;
+};
+
+uint16_t bigEndian16(const uchar* data) {
+	return (uint16_t)(data[0] << 8 | data[1]);
+}
+
+uint32_t bigEndian32(const uchar* data) {
+	return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+/**
+ * call visit(marker, position, length) for every jpeg segment before the image
+ * data, position of its 0xFF and length as in the segment, payload plus the
+ * two length bytes. stops early when visit returns false.
+ */
+template <class Visit>
+void jpegSegments(const std::vector<uchar>& bytes, Visit visit) {
+	size_t pos = 2;
+	while (pos + 4 <= bytes.size() && bytes[pos] == 0xFF) {
+		uchar marker = bytes[pos + 1];
+		if (marker == 0xFF) {
+			// fill byte
+			pos++;
+			continue;
+		}
+		if (marker == 0xDA || marker == 0xD9) {
+			// start of scan or end of image, no more metadata
+			return;
+		}
+		size_t length = bigEndian16(&bytes[pos + 2]);
+		if (length < 2 || pos + 2 + length > bytes.size()) {
+			return;
+		}
+		if (!visit(marker, pos, length)) {
+			return;
+		}
+		pos += 2 + length;
+	}
+}
+
+bool isExifSegment(const std::vector<uchar>& bytes, uchar marker, size_t pos, size_t length) {
+	return marker == 0xE1 && length >= 8 + 8 && memcmp(&bytes[pos + 4], "Exif\0\0", 6) == 0;
+}
+
+/**
+ * whether an APPn segment's payload starts with identifier, including its terminating 0.
+ */
+bool segmentIs(const std::vector<uchar>& bytes, size_t pos, size_t length, const char* identifier) {
+	size_t size = strlen(identifier) + 1;
+	return length >= 2 + size && memcmp(&bytes[pos + 4], identifier, size) == 0;
+}
+
+/**
+ * where the tiff structure holding the exif tags is in an encoded image.
+ */
+bool findExif(const std::vector<uchar>& bytes, size_t& offset, size_t& length) {
+	switch (sniffImageFormat(bytes.data(), bytes.size())) {
+	case ImageFormat::Jpeg: {
+		bool found = false;
+		jpegSegments(bytes, [&](uchar marker, size_t pos, size_t segmentLength) {
+			if (isExifSegment(bytes, marker, pos, segmentLength)) {
+				offset = pos + 10;
+				length = segmentLength - 8;
+				found = true;
+			}
+			return !found;
+		});
+		return found;
+	}
+	case ImageFormat::Tiff:
+		offset = 0;
+		length = bytes.size();
+		return true;
+	case ImageFormat::Png:
+		for (size_t pos = 8; pos + 12 <= bytes.size();) {
+			size_t chunkLength = bigEndian32(&bytes[pos]);
+			if (chunkLength > bytes.size() - pos - 12) {
+				return false;
+			}
+			if (memcmp(&bytes[pos + 4], "eXIf", 4) == 0) {
+				offset = pos + 8;
+				length = chunkLength;
+				return true;
+			}
+			if (memcmp(&bytes[pos + 4], "IEND", 4) == 0) {
+				return false;
+			}
+			pos += 12 + chunkLength;
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+/**
+ * where a new segment goes in a jpeg, after the JFIF APP0 if there is one,
+ * it has to stay first.
+ */
+size_t metadataPosition(const std::vector<uchar>& jpeg) {
+	if (jpeg.size() >= 6 && jpeg[2] == 0xFF && jpeg[3] == 0xE0) {
+		size_t length = bigEndian16(&jpeg[4]);
+		if (2 + 2 + length <= jpeg.size()) {
+			return 2 + 2 + length;
+		}
+	}
+	return 2;
+}
+
+/**
+ * point the xmp copy of the orientation at 1 as well, the value is a single
+ * digit so it's changed in place.
+ */
+void levelXmp(std::vector<uchar>& segment) {
+	for (const char* key : {"tiff:Orientation=\"", "<tiff:Orientation>"}) {
+		size_t keyLength = strlen(key);
+		auto found = std::search(segment.begin(), segment.end(), key, key + keyLength);
+		if (found != segment.end() && found + keyLength < segment.end() && *(found + keyLength) >= '1' && *(found + keyLength) <= '8') {
+			*(found + keyLength) = '1';
+		}
+	}
+}
+
+// the transform each orientation applies to the stored pixels for display,
+// as [a b; c d] on x right, y down
+const int transforms[9][4] = {
+	{1, 0, 0, 1},   // unused
+	{1, 0, 0, 1},   // 1 as stored
+	{-1, 0, 0, 1},  // 2 mirrored left to right
+	{-1, 0, 0, -1}, // 3 half a turn
+	{1, 0, 0, -1},  // 4 mirrored top to bottom
+	{0, 1, 1, 0},   // 5 transposed
+	{0, -1, 1, 0},  // 6 a quarter clockwise
+	{0, -1, -1, 0}, // 7 transposed the other way
+	{0, 1, -1, 0},  // 8 a quarter counterclockwise
+};
+
+} // namespace
+
+
+int readOrientation(const std::vector<uchar>& bytes) {
+	size_t offset, length;
+	if (!findExif(bytes, offset, length)) {
+		return 1;
+	}
+	// only read from
+	TiffView tiff(const_cast<uchar*>(bytes.data()) + offset, length);
+	uint16_t type;
+	size_t value = tiff.findValue(tiff.firstIfd(), orientationTag, type);
+	if (value == 0 || type != typeShort) {
+		return 1;
+	}
+	int orientation = tiff.get16(value);
+	return (orientation >= 1 && orientation <= 8) ? orientation : 1;
+}
+
+void applyOrientation(cv::Mat& image, int orientation) {
+	switch (orientation) {
+	case 2:
+		cv::flip(image, image, 1);
+		break;
+	case 3:
+		cv::flip(image, image, -1);
+		break;
+	case 4:
+		cv::flip(image, image, 0);
+		break;
+	case 5:
+		cv::transpose(image, image);
+		break;
+	case 6:
+		cv::transpose(image, image);
+		cv::flip(image, image, 1);
+		break;
+	case 7:
+		cv::transpose(image, image);
+		cv::flip(image, image, -1);
+		break;
+	case 8:
+		cv::transpose(image, image);
+		cv::flip(image, image, 0);
+		break;
+	}
+}
+
+int turnOrientation(int orientation, int quarters) {
+	if (orientation < 1 || orientation > 8) {
+		orientation = 1;
+	}
+	int m[4] = {transforms[orientation][0], transforms[orientation][1], transforms[orientation][2], transforms[orientation][3]};
+	// each quarter counterclockwise is orientation 8 applied on top
+	const int* turn = transforms[8];
+	for (int i = 0; i < (quarters % 4 + 4) % 4; i++) {
+		int next[4] = {
+			turn[0] * m[0] + turn[1] * m[2], turn[0] * m[1] + turn[1] * m[3],
+			turn[2] * m[0] + turn[3] * m[2], turn[2] * m[1] + turn[3] * m[3],
+		};
+		memcpy(m, next, sizeof(m));
+	}
+	for (int candidate = 1; candidate <= 8; candidate++) {
+		if (memcmp(transforms[candidate], m, sizeof(m)) == 0) {
+			return candidate;
+		}
+	}
+	return 1;
+}
+
+size_t orientationPosition(const std::vector<uchar>& bytes) {
+	ImageFormat format = sniffImageFormat(bytes.data(), bytes.size());
+	size_t offset, length;
+	if ((format != ImageFormat::Jpeg && format != ImageFormat::Tiff) || !findExif(bytes, offset, length)) {
+		return 0;
+	}
+	// only read from
+	TiffView tiff(const_cast<uchar*>(bytes.data()) + offset, length);
+	uint16_t type;
+	size_t value = tiff.findValue(tiff.firstIfd(), orientationTag, type);
+	return (value != 0 && type == typeShort) ? offset + value : 0;
+}
+
+bool writeOrientation(std::vector<uchar>& bytes, int orientation) {
+	ImageFormat format = sniffImageFormat(bytes.data(), bytes.size());
+	if (format != ImageFormat::Jpeg && format != ImageFormat::Tiff) {
+		return false;
+	}
+
+	size_t offset, length;
+	if (findExif(bytes, offset, length)) {
+		size_t position = orientationPosition(bytes);
+		if (position == 0) {
+			// adding a tag would move everything after it, not worth it
+			return false;
+		}
+		TiffView tiff(bytes.data() + offset, length);
+		tiff.put16(position - offset, (uint16_t)orientation);
+		return true;
+	}
+	if (format != ImageFormat::Jpeg) {
+		return false;
+	}
+
+	// no exif at all, a big endian one with just the orientation
+	const uchar segment[] = {
+		0xFF, 0xE1, 0x00, 0x22,
+		'E', 'x', 'i', 'f', 0x00, 0x00,
+		'M', 'M', 0x00, 0x2A, 0x00, 0x00, 0x00, 0x08,
+		0x00, 0x01,
+		0x01, 0x12, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01, 0x00, (uchar)orientation, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00,
+	};
+	bytes.insert(bytes.begin() + metadataPosition(bytes), segment, segment + sizeof(segment));
+	return true;
+}
+
+bool copyMetadata(const std::vector<uchar>& source, std::vector<uchar>& jpeg, const cv::Size& size) {
+	if (sniffImageFormat(source.data(), source.size()) != ImageFormat::Jpeg || sniffImageFormat(jpeg.data(), jpeg.size()) != ImageFormat::Jpeg) {
+		return false;
+	}
+
+	// exif and xmp are APP1, icc profiles APP2, iptc APP13. only those, the same
+	// markers also carry e.g. the mpf index of phone jpegs, whose offsets point at
+	// images after the end of the original that the output doesn't have
+	std::vector<uchar> segments;
+	jpegSegments(source, [&](uchar marker, size_t pos, size_t length) {
+		bool keep = (marker == 0xE1 && (isExifSegment(source, marker, pos, length) ||
+				segmentIs(source, pos, length, "http://ns.adobe.com/xap/1.0/") || segmentIs(source, pos, length, "http://ns.adobe.com/xmp/extension/"))) ||
+			(marker == 0xE2 && segmentIs(source, pos, length, "ICC_PROFILE")) ||
+			(marker == 0xED && segmentIs(source, pos, length, "Photoshop 3.0"));
+		if (!keep) {
+			return true;
+		}
+		std::vector<uchar> segment(source.begin() + pos, source.begin() + pos + 2 + length);
+		if (isExifSegment(source, marker, pos, length)) {
+			TiffView tiff(segment.data() + 10, segment.size() - 10);
+			uint16_t type;
+			size_t value = tiff.findValue(tiff.firstIfd(), orientationTag, type);
+			if (value != 0 && type == typeShort) {
+				tiff.put16(value, 1);
+			}
+			size_t pointer = tiff.findValue(tiff.firstIfd(), exifPointerTag, type);
+			if (pointer != 0 && type == typeLong) {
+				uint32_t exifIfd = tiff.get32(pointer);
+				for (auto dimension : {std::make_pair(pixelWidthTag, size.width), std::make_pair(pixelHeightTag, size.height)}) {
+					value = tiff.findValue(exifIfd, dimension.first, type);
+					if (value != 0 && type == typeLong) {
+						tiff.put32(value, (uint32_t)dimension.second);
+					}
+					else if (value != 0 && dimension.second <= 0xFFFF) {
+						tiff.put16(value, (uint16_t)dimension.second);
+					}
+				}
+			}
+		}
+		else if (marker == 0xE1) {
+			levelXmp(segment);
+		}
+		segments.insert(segments.end(), segment.begin(), segment.end());
+		return true;
+	});
+
+	jpeg.insert(jpeg.begin() + metadataPosition(jpeg), segments.begin(), segments.end());
+	return true;
+}
+
+} // namespace rotimage
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// the exif orientation tag, and the metadata around it. cameras store the
+/// pixels the way the sensor was held and say in the tag how to turn them for
+/// display, so this has to be known before any angle means anything.
+///
+/// values 1 - 8 as in the exif spec: 1 as stored, 3 turned half way, 6 a
+/// quarter clockwise, 8 a quarter counterclockwise, 2 4 5 7 the mirrored ones.
+///
+/// only the header is parsed, up to the first image data, nothing is decoded.
+/// read from jpeg ( APP1 ), tiff ( the first IFD ) and png ( eXIf ), written
+/// to jpeg and tiff.
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+/**
+ * @param bytes An encoded image.
+ * @return int Its orientation, 1 when it has none or the format doesn't carry one.
+ */
+int readOrientation(const std::vector<uchar>& bytes);
+
+/**
+ * turn the pixels of a decoded image the way its orientation says, so it's
+ * the right way up for display. the same as opencv does in imread() unless
+ * told not to with cv::IMREAD_IGNORE_ORIENTATION.
+ *
+ * @param image The pixels as stored, turned in place.
+ * @param orientation From readOrientation().
+ */
+void applyOrientation(cv::Mat& image, int orientation);
+
+/**
+ * the orientation that shows an image turned further by some quarter turns.
+ *
+ * @param orientation What the image has now.
+ * @param quarters Quarter turns counterclockwise, like the angles everywhere else, negative for clockwise.
+ * @return int The orientation to store instead.
+ */
+int turnOrientation(int orientation, int quarters);
+
+/**
+ * @param bytes An encoded jpeg or tiff.
+ * @return size_t Offset of the 2 byte orientation value in the file, 0 if it has none.
+ */
+size_t orientationPosition(const std::vector<uchar>& bytes);
+
+/**
+ * change the orientation of an encoded image without touching its pixels.
+ * a jpeg without any exif gets a minimal exif segment for it.
+ *
+ * @param bytes An encoded jpeg or tiff, changed in place.
+ * @param orientation The new orientation.
+ * @return bool False if the format isn't supported or the file has exif but no orientation tag to change.
+ */
+bool writeOrientation(std::vector<uchar>& bytes, int orientation);
+
+/**
+ * carry the metadata of one jpeg over to another one, e.g. the rotated output
+ * of an image: exif, icc colour profiles, xmp and iptc. the orientation is set
+ * to 1 on the way, the pixels of the output are already the right way up, and
+ * the exif pixel dimensions are set to the output's.
+ *
+ * @param source The encoded original.
+ * @param jpeg An encoded jpeg without metadata of its own, as from cv::imencode(), gets the segments.
+ * @param size The size of the image in jpeg.
+ * @return bool False if either isn't a jpeg, nothing is changed then.
+ */
+bool copyMetadata(const std::vector<uchar>& source, std::vector<uchar>& jpeg, const cv::Size& size);
+
+} // namespace rotimage
@@ -0,0 +1,148 @@
+#include "hashing.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+namespace rotimage {
+
+namespace {
+
+const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+
+inline uint64_t rotl(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+} // namespace
+
+
+Hasher::Hasher(uint64_t seed) : state(seed ^ prime1) {
+}
+
+void Hasher::mix(uint64_t word) {
+	state ^= rotl(word * prime2, 31) * prime1;
+	state = rotl(state, 27) * prime1 + prime2;
+}
+
+void Hasher::update(const void* data, size_t length) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	total += length;
+
+	// top up a partial word left over from the last call
+	if (pendingLength > 0) {
+		size_t take = std::min(length, sizeof(pending) - pendingLength);
+		memcpy(pending + pendingLength, bytes, take);
+		pendingLength += take;
+		bytes += take;
+		length -= take;
+		if (pendingLength < sizeof(pending)) {
+			return;
+		}
+		uint64_t word;
+		memcpy(&word, pending, sizeof(word));
+		mix(word);
+		pendingLength = 0;
+	}
+
+	while (length >= 8) {
+		uint64_t word;
+		memcpy(&word, bytes, sizeof(word));
+		mix(word);
+		bytes += 8;
+		length -= 8;
+	}
+
+	memcpy(pending, bytes, length);
+	pendingLength = length;
+}
+
+uint64_t Hasher::digest() const {
+	uint64_t hash = state + total;
+	for (size_t i = 0; i < pendingLength; i++) {
+		hash ^= pending[i] * prime2;
+		hash = rotl(hash, 11) * prime1;
+	}
+
+	// final avalanche
+	hash ^= hash >> 33;
+	hash *= prime2;
+	hash ^= hash >> 29;
+	hash *= prime1;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+
+uint64_t hashBytes(const void* data, size_t length, uint64_t seed) {
+	Hasher hasher(seed);
+	hasher.update(data, length);
+	return hasher.digest();
+}
+
+bool hashFile(const std::filesystem::path& path, uint64_t& hash) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+
+	Hasher hasher;
+	std::vector<char> buffer(1 << 20);
+	while (file) {
+		file.read(buffer.data(), buffer.size());
+		hasher.update(buffer.data(), (size_t)file.gcount());
+	}
+	if (file.bad()) {
+		return false;
+	}
+	hash = hasher.digest();
+	return true;
+}
+
+uint64_t hashDetector(const DetectorOptions& detector) {
+	std::ostringstream text;
+	text.precision(17);
+	text << detector.cannyLow << ' ' << detector.cannyHigh << ' ' << detector.houghThreshold << ' '
+		<< detector.minLineLength << ' ' << detector.maxLineGap
+		<< " roi " << detector.roi.x << ' ' << detector.roi.y << ' ' << detector.roi.width << ' ' << detector.roi.height
+		<< " adaptive " << detector.adaptiveEdgeFraction << " edges " << detector.maxEdgePixels
+		<< " skew " << detector.maxSkew << ' ' << detector.angleResolution << ' ' << detector.parallelVoting
+		<< " verticals " << detector.verticals << " orientation " << detector.orientation
+		<< " refine " << detector.refineWindow;
+	std::string key = text.str();
+	return hashBytes(key.data(), key.size());
+}
+
+uint64_t hashOptions(const Options& options) {
+	std::ostringstream text;
+	text.precision(17);
+	if (options.detect) {
+		text << "detect " << toHex(hashDetector(options.detector));
+	}
+	else {
+		text << "angle " << options.angle;
+	}
+	text << " strip " << options.stripMetadata << " metadata " << options.metadataRotate << " unchanged " << options.unchanged;
+	std::string key = text.str();
+	return hashBytes(key.data(), key.size());
+}
+
+std::string toHex(uint64_t value) {
+	char text[17];
+	snprintf(text, sizeof(text), "%016llx", (unsigned long long)value);
+	return text;
+}
+
+bool fromHex(const std::string& text, uint64_t& value) {
+	if (text.empty() || text.size() > 16) {
+		return false;
+	}
+	char* end = nullptr;
+	value = strtoull(text.c_str(), &end, 16);
+	return end == text.c_str() + text.size();
+}
+
+} // namespace rotimage
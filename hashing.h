@@ -0,0 +1,61 @@
+#pragma once
+
+#include "librotimage.h"
+#include <cstdint>
+#include <string>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// fast non-cryptographic hashing, used to tell whether an input or the
+/// settings changed since the last run.
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+/**
+ * incremental 64 bit hash, consumes 8 bytes at a time.
+ */
+class Hasher {
+public:
+	explicit Hasher(uint64_t seed = 0);
+
+	void update(const void* data, size_t length);
+	uint64_t digest() const;
+
+private:
+	void mix(uint64_t word);
+
+	uint64_t state;
+	uint64_t total = 0;
+	unsigned char pending[8];
+	size_t pendingLength = 0;
+};
+
+/**
+ * hash a block of memory in one go.
+ */
+uint64_t hashBytes(const void* data, size_t length, uint64_t seed = 0);
+
+/**
+ * hash the whole contents of a file.
+ *
+ * @param path The file to read.
+ * @param hash Receives the hash.
+ * @return bool False if the file couldn't be read.
+ */
+bool hashFile(const std::filesystem::path& path, uint64_t& hash);
+
+/**
+ * hash of the settings that change what gets written for an image, so two runs
+ * with the same result agree and anything else ( verbosity, recursion ) doesn't matter.
+ */
+uint64_t hashOptions(const Options& options);
+
+/**
+ * hash of just the detector settings, anything that changes the estimated angle.
+ */
+uint64_t hashDetector(const DetectorOptions& detector);
+
+std::string toHex(uint64_t value);
+bool fromHex(const std::string& text, uint64_t& value);
+
+} // namespace rotimage
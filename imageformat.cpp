@@ -0,0 +1,81 @@
+#include "imageformat.h"
+
+#include <cctype>
+#include <cstring>
+#include <fstream>
+
+namespace rotimage {
+
+namespace {
+
+bool startsWith(const unsigned char* header, size_t length, const char* magic, size_t magicLength, size_t offset = 0) {
+	return length >= offset + magicLength && memcmp(header + offset, magic, magicLength) == 0;
+}
+
+} // namespace
+
+
+ImageFormat sniffImageFormat(const unsigned char* header, size_t length) {
+	if (startsWith(header, length, "\xFF\xD8\xFF", 3)) {
+		return ImageFormat::Jpeg;
+	}
+	if (startsWith(header, length, "\x89PNG\r\n\x1A\n", 8)) {
+		return ImageFormat::Png;
+	}
+	if (startsWith(header, length, "BM", 2)) {
+		return ImageFormat::Bmp;
+	}
+	// classic tiff, both byte orders
+	if (startsWith(header, length, "II*\0", 4) || startsWith(header, length, "MM\0*", 4)) {
+		return ImageFormat::Tiff;
+	}
+	// big tiff, both byte orders
+	if (startsWith(header, length, "II+\0", 4) || startsWith(header, length, "MM\0+", 4)) {
+		return ImageFormat::BigTiff;
+	}
+	if (startsWith(header, length, "RIFF", 4) && startsWith(header, length, "WEBP", 4, 8)) {
+		return ImageFormat::WebP;
+	}
+	// jp2 container or a bare codestream
+	if (startsWith(header, length, "\0\0\0\x0CjP  \r\n\x87\n", 12)) {
+		return ImageFormat::Jpeg2000;
+	}
+	if (startsWith(header, length, "\xFF\x4F\xFF\x51", 4)) {
+		return ImageFormat::Jpeg2000Codestream;
+	}
+	if (startsWith(header, length, "\x76\x2F\x31\x01", 4)) {
+		return ImageFormat::OpenExr;
+	}
+	if (length >= 3 && header[0] == 'P' && (header[1] == 'F' || header[1] == 'f') && (header[2] == '\n' || header[2] == '\r')) {
+		return ImageFormat::Pfm;
+	}
+	// P1 - P6 are pbm / pgm / ppm, P7 is pam
+	if (length >= 3 && header[0] == 'P' && header[1] >= '1' && header[1] <= '7' && isspace(header[2])) {
+		return header[1] == '7' ? ImageFormat::Pam : ImageFormat::Pnm;
+	}
+	if (startsWith(header, length, "#?RADIANCE", 10) || startsWith(header, length, "#?RGBE", 6)) {
+		return ImageFormat::Radiance;
+	}
+	if (startsWith(header, length, "\x59\xA6\x6A\x95", 4)) {
+		return ImageFormat::SunRaster;
+	}
+	if (startsWith(header, length, "GIF87a", 6) || startsWith(header, length, "GIF89a", 6)) {
+		return ImageFormat::Gif;
+	}
+	if (startsWith(header, length, "ftypavif", 8, 4) || startsWith(header, length, "ftypavis", 8, 4)) {
+		return ImageFormat::Avif;
+	}
+	return ImageFormat::Unknown;
+}
+
+ImageFormat sniffImageFormat(const std::filesystem::path& path) {
+	unsigned char header[sniffLength];
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		return ImageFormat::Unknown;
+	}
+	file.read((char*)header, sizeof(header));
+	return sniffImageFormat(header, (size_t)file.gcount());
+}
+
+} // namespace rotimage
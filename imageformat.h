@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// tell images apart by their first bytes instead of their name, so .JPG,
+/// .webp or a png saved as .jpg are all found, and a text file called .jpg
+/// never gets as far as a decode.
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+/**
+ * variants an opencv build may decode with different codecs, or not at all,
+ * are told apart: big tiff, a bare jpeg 2000 codestream, pam.
+ */
+enum class ImageFormat {
+	Unknown,
+	Jpeg,
+	Png,
+	Bmp,
+	Tiff,
+	BigTiff,
+	WebP,
+	Jpeg2000,
+	Jpeg2000Codestream,
+	OpenExr,
+	Pnm,
+	Pam,
+	Pfm,
+	Radiance,
+	SunRaster,
+	Gif,
+	Avif,
+	Count
+};
+
+/**
+ * how many leading bytes sniffImageFormat wants to see.
+ */
+const size_t sniffLength = 16;
+
+/**
+ * classify an encoded image from its leading bytes.
+ *
+ * @param header The start of the file.
+ * @param length Number of bytes in header, sniffLength or less for short files.
+ * @return ImageFormat The format, Unknown if the signature isn't recognised.
+ */
+ImageFormat sniffImageFormat(const unsigned char* header, size_t length);
+
+/**
+ * read the first bytes of a file and classify it.
+ *
+ * @param path The file to look at.
+ * @return ImageFormat The format, Unknown if unreadable or not recognised.
+ */
+ImageFormat sniffImageFormat(const std::filesystem::path& path);
+
+} // namespace rotimage
@@ -0,0 +1,161 @@
+#include "journal.h"
+#include "hashing.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace rotimage {
+
+namespace {
+
+const char* header = "# rotImage journal v1 ";
+
+// synced after this many images or this long, whichever comes first
+const size_t syncCount = 256;
+const std::chrono::seconds syncInterval(2);
+
+bool syncToDisk(std::FILE* file) {
+	if (std::fflush(file) != 0) {
+		return false;
+	}
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+} // namespace
+
+
+Journal::~Journal() {
+	close();
+}
+
+bool Journal::open(const std::string& path, uint64_t optionsHash, bool resume) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	bool fresh = true;
+	if (resume) {
+		std::ifstream existing(path, std::ios::binary);
+		std::stringstream contents;
+		contents << existing.rdbuf();
+		std::string text = contents.str();
+
+		if (!text.empty()) {
+			if (text.compare(0, strlen(header), header) != 0) {
+				std::cerr << "Not a journal: " << path << std::endl;
+				return false;
+			}
+			// a header cut off mid write means nothing was recorded yet, start over
+			size_t end = text.find('\n');
+			if (end != std::string::npos) {
+				uint64_t written = 0;
+				if (!fromHex(text.substr(strlen(header), end - strlen(header)), written)) {
+					std::cerr << "Not a journal: " << path << std::endl;
+					return false;
+				}
+				if (written != optionsHash) {
+					std::cerr << "The journal was written with different settings, can't resume from it: " << path << std::endl;
+					return false;
+				}
+				fresh = false;
+
+				// only whole lines, the last one may have been cut off mid write
+				size_t complete = text.rfind('\n') + 1;
+				for (size_t start = end + 1; start < complete;) {
+					size_t newline = text.find('\n', start);
+					if (newline > start) {
+						finished.insert(text.substr(start, newline - start));
+					}
+					start = newline + 1;
+				}
+
+				if (complete != text.size()) {
+					std::error_code ec;
+					std::filesystem::resize_file(path, complete, ec);
+				}
+			}
+		}
+	}
+
+#ifdef _WIN32
+	// plain fopen is deprecated there, an error with the sdl checks the project builds with
+	if (fopen_s(&file, path.c_str(), fresh ? "wb" : "ab") != 0) {
+		file = nullptr;
+	}
+#else
+	file = std::fopen(path.c_str(), fresh ? "wb" : "ab");
+#endif
+	if (!file) {
+		return false;
+	}
+	if (fresh) {
+		std::string first = header + toHex(optionsHash) + "\n";
+		if (std::fwrite(first.data(), 1, first.size(), file) != first.size() || !syncToDisk(file)) {
+			return false;
+		}
+	}
+	lastSync = std::chrono::steady_clock::now();
+	return true;
+}
+
+bool Journal::done(const std::string& relativePath) const {
+	return finished.count(relativePath) != 0;
+}
+
+void Journal::record(const std::string& relativePath) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!file) {
+		return;
+	}
+	pending += relativePath;
+	pending += '\n';
+	pendingCount++;
+
+	// one fsync per batch keeps the journal cheap, the images are far slower than this
+	if (pendingCount >= syncCount || std::chrono::steady_clock::now() - lastSync >= syncInterval) {
+		sync();
+	}
+}
+
+bool Journal::close() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!file) {
+		return true;
+	}
+	sync();
+	std::fclose(file);
+	file = nullptr;
+	return !failed;
+}
+
+size_t Journal::resumed() const {
+	return finished.size();
+}
+
+bool Journal::sync() {
+	if (!pending.empty()) {
+		if (std::fwrite(pending.data(), 1, pending.size(), file) != pending.size() || !syncToDisk(file)) {
+			if (!failed) {
+				std::cerr << "Failed to write the journal, a resumed run will redo some images" << std::endl;
+			}
+			failed = true;
+		}
+		pending.clear();
+		pendingCount = 0;
+	}
+	lastSync = std::chrono::steady_clock::now();
+	return !failed;
+}
+
+} // namespace rotimage
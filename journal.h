@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// checkpoints for long batches. every image that finishes is appended to the
+/// journal, a resumed run skips whatever is already in it so a killed batch
+/// picks up where it stopped instead of starting over.
+///
+/// one line per image, its path relative to the input directory, after a
+/// "# rotImage journal v1 <settings hash>" header. lines are buffered and
+/// written and synced to disk in batches, a crash loses at most the last batch
+/// and those images are simply done again ( outputs are replaced atomically,
+/// so that's safe ).
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+/**
+ * safe to use from multiple threads.
+ */
+class Journal {
+public:
+	~Journal();
+
+	/**
+	 * start a journal, or carry on with one.
+	 *
+	 * @param path The journal file.
+	 * @param optionsHash hashOptions() of the batch, a journal written with other settings isn't resumed.
+	 * @param resume Load what's already there and append to it, instead of starting over.
+	 * @return bool False if it couldn't be read or written, or was written with other settings.
+	 */
+	bool open(const std::string& path, uint64_t optionsHash, bool resume);
+
+	/**
+	 * @param relativePath Path relative to the input directory, with / separators.
+	 * @return bool True if the image finished in the run being resumed.
+	 */
+	bool done(const std::string& relativePath) const;
+
+	/**
+	 * remember that an image finished, it reaches the disk with the next batch.
+	 *
+	 * @param relativePath Path relative to the input directory, with / separators.
+	 */
+	void record(const std::string& relativePath);
+
+	/**
+	 * write and sync whatever is still buffered, called by the destructor if needed.
+	 *
+	 * @return bool False if anything failed to write.
+	 */
+	bool close();
+
+	/**
+	 * @return size_t Number of images finished by the run being resumed.
+	 */
+	size_t resumed() const;
+
+private:
+	bool sync();
+
+	// filled by open() and only read after that, no lock needed
+	std::unordered_set<std::string> finished;
+
+	std::mutex mutex;
+	std::FILE* file = nullptr;
+	std::string pending;
+	size_t pendingCount = 0;
+	std::chrono::steady_clock::time_point lastSync;
+	bool failed = false;
+};
+
+} // namespace rotimage
@@ -0,0 +1,1075 @@
+#include "librotimage.h"
+#include "anglecache.h"
+#include "anglereport.h"
+#include "exif.h"
+#include "hashing.h"
+#include "imageformat.h"
+#include "journal.h"
+#include "manifest.h"
+#include "orientation.h"
+#include "refineangle.h"
+#include "restrictedhough.h"
+#include "scanner.h"
+#include "workerpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <string>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace rotimage {
+
+bool readFileBytes(const std::string& path, std::vector<uchar>& bytes) {
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file) {
+		return false;
+	}
+	bytes.resize((size_t)file.tellg());
+	file.seekg(0);
+	return (bool)file.read((char*)bytes.data(), bytes.size());
+}
+
+namespace {
+
+/**
+ * name for a temporary file next to path, unique between the threads and
+ * processes ( shards on other machines ) writing to the same directory.
+ */
+std::filesystem::path temporaryPath(const std::filesystem::path& path) {
+	static const uint64_t salt = ((uint64_t)std::random_device()() << 32) ^ std::random_device()();
+	static std::atomic<uint64_t> counter(0);
+	std::string name = "." + path.filename().string() + "." + toHex(salt + counter++) + ".tmp";
+	return path.parent_path() / name;
+}
+
+#ifdef O_TMPFILE
+
+bool writeAll(int fd, const uchar* data, size_t length) {
+	while (length > 0) {
+		ssize_t written = ::write(fd, data, length);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += written;
+		length -= (size_t)written;
+	}
+	return true;
+}
+
+/**
+ * write into an unnamed O_TMPFILE in the target's directory and only link it
+ * in once it's complete, nothing is left behind if the process dies first.
+ *
+ * @return int 1 written, 0 failed, -1 not supported here ( e.g. nfs, no /proc ), use a named temporary.
+ */
+int writeUnnamed(const std::filesystem::path& path, const std::vector<uchar>& bytes) {
+	std::filesystem::path directory = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+	int fd = ::open(directory.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		return (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL) ? -1 : 0;
+	}
+	if (!writeAll(fd, bytes.data(), bytes.size())) {
+		::close(fd);
+		return 0;
+	}
+
+	std::string self = "/proc/self/fd/" + std::to_string(fd);
+	int result = -1;
+	if (::linkat(AT_FDCWD, self.c_str(), AT_FDCWD, path.c_str(), AT_SYMLINK_FOLLOW) == 0) {
+		result = 1;
+	}
+	else if (errno == EEXIST) {
+		// linkat won't replace a file, link it under a temporary name and rename that over
+		std::string temporary = temporaryPath(path).string();
+		if (::linkat(AT_FDCWD, self.c_str(), AT_FDCWD, temporary.c_str(), AT_SYMLINK_FOLLOW) == 0) {
+			result = ::rename(temporary.c_str(), path.c_str()) == 0 ? 1 : 0;
+			if (result == 0) {
+				::unlink(temporary.c_str());
+			}
+		}
+	}
+	::close(fd);
+	return result;
+}
+
+#endif
+
+} // namespace
+
+bool writeFileBytes(const std::string& path, const std::vector<uchar>& bytes) {
+	std::filesystem::path target(path);
+
+#ifdef O_TMPFILE
+	int unnamed = writeUnnamed(target, bytes);
+	if (unnamed >= 0) {
+		return unnamed == 1;
+	}
+#endif
+
+	// written under a temporary name and renamed over the target, so it never exists half written
+	std::filesystem::path temporary = temporaryPath(target);
+	std::error_code ec;
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		file.write((const char*)bytes.data(), bytes.size());
+		file.close();
+		if (file.fail()) {
+			std::filesystem::remove(temporary, ec);
+			return false;
+		}
+	}
+	std::filesystem::rename(temporary, target, ec);
+	if (ec) {
+		std::filesystem::remove(temporary, ec);
+		return false;
+	}
+	return true;
+}
+
+
+cv::Mat decodeImage(const std::vector<uchar>& bytes, int flags) {
+	// opencv applies the orientation itself for some formats and flags but not others,
+	// so for the formats readOrientation() knows it's done here. the rest ( webp, avif )
+	// are left to opencv, which is all they had before
+	ImageFormat format = sniffImageFormat(bytes.data(), bytes.size());
+	if (format != ImageFormat::Jpeg && format != ImageFormat::Tiff && format != ImageFormat::Png) {
+		return cv::imdecode(bytes, flags);
+	}
+	cv::Mat image = cv::imdecode(bytes, flags | cv::IMREAD_IGNORE_ORIENTATION);
+	if (!image.empty()) {
+		applyOrientation(image, readOrientation(bytes));
+	}
+	return image;
+}
+
+int decodeFlags(const Options& options) {
+	return options.unchanged ? cv::IMREAD_UNCHANGED : cv::IMREAD_COLOR;
+}
+
+namespace {
+
+/**
+ * formats opencv only writes 8 bit to.
+ */
+bool eightBitOnly(std::string extension) {
+	for (char& c : extension) {
+		c = (char)std::tolower((unsigned char)c);
+	}
+	for (const char* known : { ".jpg", ".jpeg", ".jpe", ".webp", ".bmp", ".dib", ".ras", ".sr" }) {
+		if (extension == known) {
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace
+
+bool encodeImage(const std::string& extension, const cv::Mat& image, std::vector<uchar>& encoded, const std::vector<uchar>* original) {
+	cv::Mat pixels = image;
+	if (image.depth() != CV_8U && eightBitOnly(extension)) {
+		// opencv would convert without scaling, a 16 bit image comes out nearly all white
+		// float is taken as 0 - 1 the way opencv treats it everywhere else
+		double scale = image.depth() == CV_16U ? 1.0 / 257.0 : image.depth() >= CV_32F ? 255.0 : 1.0;
+		image.convertTo(pixels, CV_8U, scale);
+	}
+	if (!cv::imencode(extension, pixels, encoded)) {
+		encoded.clear();
+		return false;
+	}
+	if (original) {
+		// does nothing unless both are jpeg
+		copyMetadata(*original, encoded, image.size());
+	}
+	return true;
+}
+
+
+bool isImageFile(const std::filesystem::path& path) {
+	// whether this opencv build can decode each format, found out the first time one is seen.
+	// the sniffer gives every signature opencv has a separate decoder for its own value
+	// 0 not checked yet, 1 yes, 2 no
+	static std::atomic<int> readable[(size_t)ImageFormat::Count];
+
+	ImageFormat format = sniffImageFormat(path);
+	if (format == ImageFormat::Unknown) {
+		// not in our table, opencv may still have a decoder for it
+		return cv::haveImageReader(path.string());
+	}
+
+	auto& known = readable[(size_t)format];
+	if (known == 0) {
+		known = cv::haveImageReader(path.string()) ? 1 : 2;
+	}
+	return known == 1;
+}
+
+bool inShard(const std::string& relativePath, const Options& options) {
+	if (options.shardCount <= 1) {
+		return true;
+	}
+	return hashBytes(relativePath.data(), relativePath.size()) % options.shardCount == options.shard;
+}
+
+
+namespace {
+
+/**
+ * detector.roi in pixels, clipped to the image.
+ */
+cv::Rect detectionRegion(const cv::Size& size, const DetectorOptions& detector) {
+	cv::Rect whole(0, 0, size.width, size.height);
+	cv::Rect2d roi = detector.roi;
+	if (roi.empty()) {
+		return whole;
+	}
+	if (roi.x <= 1.0 && roi.y <= 1.0 && roi.width <= 1.0 && roi.height <= 1.0) {
+		roi = cv::Rect2d(roi.x * size.width, roi.y * size.height, roi.width * size.width, roi.height * size.height);
+	}
+	return cv::Rect(cvRound(roi.x), cvRound(roi.y), cvRound(roi.width), cvRound(roi.height)) & whole;
+}
+
+/**
+ * 8 bit gray for the detector, from whatever was decoded. anything deeper is
+ * stretched over the range it actually uses, 16 bit scans and float data rarely
+ * fill theirs and would come out nearly black with a fixed scale.
+ */
+cv::Mat luminance(const cv::Mat& src) {
+	cv::Mat gray;
+	switch (src.channels()) {
+	case 1:
+		gray = src;
+		break;
+	case 3:
+		cv::cvtColor(src, gray, cv::COLOR_BGR2GRAY);
+		break;
+	case 4:
+		cv::cvtColor(src, gray, cv::COLOR_BGRA2GRAY);
+		break;
+	default:
+		// gray with alpha
+		cv::extractChannel(src, gray, 0);
+		break;
+	}
+	if (gray.depth() == CV_8U) {
+		return gray;
+	}
+
+	double low = 0.0, high = 0.0;
+	cv::minMaxLoc(gray, &low, &high);
+	double scale = high > low ? 255.0 / (high - low) : 0.0;
+	cv::Mat scaled;
+	gray.convertTo(scaled, CV_8U, scale, -low * scale);
+	return scaled;
+}
+
+/**
+ * canny with the thresholds taken from the image: the high one is the gradient
+ * only the strongest detector.adaptiveEdgeFraction of pixels reach.
+ */
+void adaptiveCanny(const cv::Mat& gray, cv::Mat& edges, const DetectorOptions& detector) {
+	// the same 3x3 sobel canny would do itself, handed over so it only runs once
+	cv::Mat dx, dy;
+	cv::Sobel(gray, dx, CV_16S, 1, 0, 3);
+	cv::Sobel(gray, dy, CV_16S, 0, 1, 3);
+
+	// histogram of the L1 magnitude canny compares against, at most 2 * 4 * 255
+	std::vector<size_t> histogram(2 * 4 * 255 + 1, 0);
+	for (int y = 0; y < gray.rows; y++) {
+		const short* rowX = dx.ptr<short>(y);
+		const short* rowY = dy.ptr<short>(y);
+		for (int x = 0; x < gray.cols; x++) {
+			histogram[std::abs(rowX[x]) + std::abs(rowY[x])]++;
+		}
+	}
+
+	size_t strongest = (size_t)(detector.adaptiveEdgeFraction * gray.total());
+	size_t seen = 0;
+	int high = (int)histogram.size() - 1;
+	while (high > 0 && seen + histogram[high] <= strongest) {
+		seen += histogram[high];
+		high--;
+	}
+
+	// never so low that noise in a flat image turns into edges
+	double cannyHigh = std::max((double)high, 20.0);
+	cv::Canny(dx, dy, edges, 0.4 * cannyHigh, cannyHigh);
+}
+
+/**
+ * keep every step-th edge pixel in raster order. along a near horizontal line
+ * that leaves gaps of step pixels, which the line detector can bridge.
+ */
+void thinEdges(cv::Mat& edges, int step) {
+	int count = 0;
+	for (int y = 0; y < edges.rows; y++) {
+		uchar* row = edges.ptr<uchar>(y);
+		for (int x = 0; x < edges.cols; x++) {
+			if (row[x] && count++ % step != 0) {
+				row[x] = 0;
+			}
+		}
+	}
+}
+
+/**
+ * an angle in radians moved by quarter turns to between -45 and 45 degrees.
+ */
+double foldQuarter(double theta) {
+	return theta - (CV_PI / 2) * std::round(theta / (CV_PI / 2));
+}
+
+/**
+ * the original detector, probabilistic hough over every angle at 1 degree,
+ * then the mean angle of the segments it found.
+ */
+AngleEstimate probabilisticEstimate(const cv::Mat& edges, int houghThreshold, double maxLineGap, const DetectorOptions& detector) {
+	// line detection
+	std::vector<cv::Vec4i> lines;
+	cv::HoughLinesP(edges, lines, 1, CV_PI / 180, houghThreshold, detector.minLineLength, maxLineGap);
+
+	// calculate the average angle of the lines
+	// not a great method
+	std::vector<double> thetas;
+	thetas.reserve(lines.size());
+	double angle = 0.0;
+	double sines = 0.0;
+	double cosines = 0.0;
+	for (const auto& line : lines) {
+		double theta = atan2(line[3] - line[1], line[2] - line[0]);
+		if (detector.verticals) {
+			// a vertical line skewed by a is at 90 + a, fold it onto the horizontal ones
+			theta = foldQuarter(theta);
+			sines += std::sin(4.0 * theta);
+			cosines += std::cos(4.0 * theta);
+		}
+		thetas.push_back(theta);
+		angle += theta;
+	}
+
+	AngleEstimate estimate;
+	estimate.lines = (int)thetas.size();
+	if (estimate.lines == 0) {
+		return estimate;
+	}
+	angle /= estimate.lines; // average the angle
+	if (detector.verticals) {
+		// folded angles wrap around at 45 degrees, -44 and 44 are 2 apart and average to 45 not 0
+		angle = std::atan2(sines, cosines) / 4.0;
+	}
+	estimate.angle = angle * (180.0 / CV_PI);
+
+	// how many of the lines actually agree with the average
+	int agreeing = 0;
+	for (double theta : thetas) {
+		double difference = detector.verticals ? foldQuarter(theta - angle) : theta - angle;
+		if (std::abs(difference) * (180.0 / CV_PI) <= 1.0) {
+			agreeing++;
+		}
+	}
+	estimate.confidence = (double)agreeing / estimate.lines;
+	return estimate;
+}
+
+} // namespace
+
+AngleEstimate estimateRotation(const cv::Mat& src, const DetectorOptions& detector) {
+	if (detector.orientation && (!detector.verticals || detector.refineWindow <= 0.0)) {
+		// a page on its side has vertical lines, and the orientation can only be told once it's exactly level
+		DetectorOptions oriented = detector;
+		oriented.verticals = true;
+		if (oriented.refineWindow <= 0.0) {
+			oriented.refineWindow = 1.0;
+		}
+		return estimateRotation(src, oriented);
+	}
+
+	// crop first, a view into src, the rest of the image isn't even converted
+	cv::Rect region = detectionRegion(src.size(), detector);
+	if (region.empty()) {
+		return AngleEstimate();
+	}
+
+	// convert to 8 bit grayscale, blurred into a new image, for gray input the proxy is src itself
+	cv::Mat gray;
+	cv::GaussianBlur(luminance(src(region)), gray, cv::Size(5, 5), 0);
+
+	// edge detection
+	cv::Mat edges;
+	if (detector.adaptiveEdgeFraction > 0.0) {
+		adaptiveCanny(gray, edges, detector);
+	}
+	else {
+		cv::Canny(gray, edges, detector.cannyLow, detector.cannyHigh, 3);
+	}
+
+	// the line detector's time goes with the number of edge pixels, cap it
+	int houghThreshold = detector.houghThreshold;
+	double maxLineGap = detector.maxLineGap;
+	if (detector.maxEdgePixels > 0) {
+		int count = cv::countNonZero(edges);
+		if (count > detector.maxEdgePixels) {
+			int step = (count + detector.maxEdgePixels - 1) / detector.maxEdgePixels;
+			thinEdges(edges, step);
+			// a line now only gets a step-th of the votes, with step pixel gaps
+			houghThreshold = std::max(1, houghThreshold / step);
+			maxLineGap = std::max(maxLineGap, (double)step);
+		}
+	}
+
+	AngleEstimate estimate;
+	if (detector.maxSkew > 0.0) {
+		estimate = detector.parallelVoting ? bandedEstimate(edges, houghThreshold, detector) : restrictedEstimate(edges, houghThreshold, detector);
+	}
+	else {
+		estimate = probabilisticEstimate(edges, houghThreshold, maxLineGap, detector);
+	}
+
+	// nothing found means nothing to refine around
+	if (detector.refineWindow > 0.0 && estimate.lines > 0) {
+		estimate.angle = refineAngle(gray, estimate.angle, detector.refineWindow, detector.verticals);
+	}
+	if (detector.orientation && estimate.lines > 0) {
+		estimate.angle += detectOrientation(gray, estimate.angle);
+	}
+	return estimate;
+}
+
+
+double determineRotationAngle(const cv::Mat& src, const DetectorOptions& detector) {
+	return estimateRotation(src, detector).angle;
+}
+
+
+double calculateReferenceAngle(const std::string& referenceImagePath, bool& successful, const Options& options) {
+	std::vector<uchar> encoded;
+	cv::Mat referenceImage;
+	if (readFileBytes(referenceImagePath, encoded)) {
+		referenceImage = decodeImage(encoded, decodeFlags(options));
+	}
+	if (referenceImage.empty()) {
+		std::cerr << "Could not open or find the reference image: " << referenceImagePath << std::endl;
+		successful = false;
+		return 0.0;
+	}
+
+	double angle = determineRotationAngle(referenceImage, options.detector);
+	if (options.verbose) {
+		std::cout << "Rotation angle determined from reference image: " << angle << " degrees" << std::endl;
+	}
+	successful = true;
+	return angle;
+}
+
+
+cv::Mat rotateImage(const cv::Mat& src, double angle) {
+	// whole quarter turns just move pixels around, only what's left over is interpolated
+	int quarters = (int)std::lround(angle / 90.0);
+	angle -= 90.0 * quarters;
+	cv::Mat turned = src;
+	switch ((quarters % 4 + 4) % 4) {
+	case 1:
+		cv::rotate(src, turned, cv::ROTATE_90_COUNTERCLOCKWISE);
+		break;
+	case 2:
+		cv::rotate(src, turned, cv::ROTATE_180);
+		break;
+	case 3:
+		cv::rotate(src, turned, cv::ROTATE_90_CLOCKWISE);
+		break;
+	}
+	if (angle == 0.0) {
+		// a copy either way, same as the warp gives
+		return turned.data == src.data ? src.clone() : turned;
+	}
+
+	cv::Point2f center(turned.cols / 2.0f, turned.rows / 2.0f);
+	cv::Mat rot = cv::getRotationMatrix2D(center, angle, 1.0);
+	cv::Rect2f bbox = cv::RotatedRect(cv::Point2f(), turned.size(), (float)angle).boundingRect2f();
+	rot.at<double>(0, 2) += bbox.width / 2.0 - turned.cols / 2.0;
+	rot.at<double>(1, 2) += bbox.height / 2.0 - turned.rows / 2.0;
+
+	cv::Mat dst;
+	if (turned.channels() == 2 || turned.channels() == 4) {
+		// the alpha fades out to transparent corners, the colours are carried on
+		// past the edge instead so the edge pixels don't blend with black
+		std::vector<cv::Mat> planes;
+		cv::split(turned, planes);
+		cv::Mat alpha = planes.back();
+		planes.pop_back();
+		cv::Mat colour, rotatedColour, rotatedAlpha;
+		cv::merge(planes, colour);
+		cv::warpAffine(colour, rotatedColour, rot, bbox.size(), cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+		cv::warpAffine(alpha, rotatedAlpha, rot, bbox.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar());
+		cv::split(rotatedColour, planes);
+		planes.push_back(rotatedAlpha);
+		cv::merge(planes, dst);
+		return dst;
+	}
+	cv::warpAffine(turned, dst, rot, bbox.size());
+	return dst;
+}
+
+
+bool processSingleImage(const std::string& inputFile, const std::string& outputFile, const Options& options) {
+	// always the given angle, processFile would detect when options.detect is set
+	Options fixed = options;
+	fixed.detect = false;
+	return Deskewer(fixed).processFile(inputFile, outputFile);
+}
+
+
+bool isTransient(FileStatus status) {
+	return status == FileStatus::ReadFailed || status == FileStatus::WriteFailed;
+}
+
+const char* toString(FileStatus status) {
+	switch (status) {
+	case FileStatus::Ok: return "ok";
+	case FileStatus::ReadFailed: return "read failed";
+	case FileStatus::DecodeFailed: return "not a decodable image";
+	case FileStatus::RotateFailed: return "rotate failed";
+	case FileStatus::EncodeFailed: return "encode failed";
+	case FileStatus::WriteFailed: return "write failed";
+	}
+	return "unknown";
+}
+
+
+namespace {
+
+/**
+ * state shared by every file of one processDirectory call.
+ */
+struct Batch {
+	Batch(const std::string& inputDir, const Options& options) : options(options), deskewer(options), optionsHash(hashOptions(options)), root(inputDir) {
+	}
+
+	const Options& options;
+	Deskewer deskewer;
+	uint64_t optionsHash;
+	std::filesystem::path root;
+	std::unique_ptr<Manifest> manifest;
+	std::unique_ptr<Journal> journal;
+	std::unique_ptr<AngleReportWriter> report;
+	std::unordered_map<std::string, double> angles;
+
+	std::atomic<size_t> succeeded{0};
+	std::atomic<size_t> failed{0};
+	std::mutex failuresMutex;
+	std::ofstream failures;
+};
+
+FileStatus detectBatchImage(Batch& batch, const std::filesystem::path& input, const std::string& relative) {
+	std::vector<uchar> encoded;
+	if (!readFileBytes(input.string(), encoded)) {
+		std::cerr << "Could not read the image: " << input << std::endl;
+		return FileStatus::ReadFailed;
+	}
+	cv::Mat image = decodeImage(encoded, decodeFlags(batch.options));
+	if (image.empty()) {
+		std::cerr << "Could not decode the image: " << input << std::endl;
+		return FileStatus::DecodeFailed;
+	}
+
+	// the cache is keyed on the file contents, already in memory
+	AngleRecord record;
+	record.path = relative;
+	record.estimate = batch.deskewer.detect(image, batch.options.angleCache ? hashBytes(encoded.data(), encoded.size()) : 0);
+	batch.report->write(record);
+
+	if (batch.options.verbose) {
+		std::cout << "Rotation angle determined from image: " << record.estimate.angle << " degrees, confidence " << record.estimate.confidence << std::endl;
+	}
+	return FileStatus::Ok;
+}
+
+FileStatus processBatchImage(Batch& batch, const std::filesystem::path& input, const std::string& relative, const std::string& outputFile) {
+	if (batch.report) {
+		return detectBatchImage(batch, input, relative);
+	}
+
+	const Deskewer* deskewer = &batch.deskewer;
+	uint64_t optionsHash = batch.optionsHash;
+	std::unique_ptr<Deskewer> fromReport;
+
+	if (!batch.options.anglesFrom.empty()) {
+		auto found = batch.angles.find(relative);
+		if (found == batch.angles.end()) {
+			std::cerr << "Warning: No angle for " << relative << " in " << batch.options.anglesFrom << ", skipping" << std::endl;
+			return FileStatus::Ok;
+		}
+		Options fileOptions = batch.options;
+		fileOptions.detect = false;
+		fileOptions.angle = found->second;
+		fromReport = std::make_unique<Deskewer>(fileOptions);
+		deskewer = fromReport.get();
+		optionsHash = hashOptions(fileOptions);
+	}
+
+	ManifestEntry current;
+	if (batch.manifest && batch.manifest->check(input, outputFile, optionsHash, current)) {
+		if (batch.options.verbose) {
+			std::cout << "Unchanged since the last run, skipping " << input << std::endl;
+		}
+		return FileStatus::Ok;
+	}
+
+	// detecting decodes the file once for both the estimate and the rotation
+	double angle = 0.0;
+	FileStatus status = deskewer->processFileStatus(input.string(), outputFile, &angle, batch.manifest ? &current.contentHash : nullptr);
+	if (status != FileStatus::Ok) {
+		return status;
+	}
+
+	if (batch.manifest) {
+		current.angle = angle;
+		current.output = outputFile;
+		// written over the input ( e.g. an exif turn in place ), record it as it is now,
+		// otherwise the next run sees a changed file and turns it again
+		std::error_code ec;
+		if (std::filesystem::equivalent(input, outputFile, ec)) {
+			current.size = std::filesystem::file_size(input, ec);
+			current.mtime = std::filesystem::last_write_time(input, ec).time_since_epoch().count();
+			if (ec || !hashFile(input, current.contentHash)) {
+				return FileStatus::Ok;
+			}
+		}
+		batch.manifest->record(input, current);
+	}
+	return FileStatus::Ok;
+}
+
+/**
+ * process one image, retrying failures that look transient ( network mounts
+ * dropping out, a full disk being cleaned up ) with a growing delay.
+ */
+FileStatus processWithRetries(Batch& batch, const std::filesystem::path& input, const std::string& relative, const std::string& outputFile) {
+	for (unsigned attempt = 0;; attempt++) {
+		FileStatus status;
+		try {
+			status = processBatchImage(batch, input, relative, outputFile);
+		}
+		catch (const std::exception& e) {
+			// most likely opencv choking on a malformed file, the same again won't help
+			std::cerr << e.what() << std::endl;
+			return FileStatus::DecodeFailed;
+		}
+
+		if (status == FileStatus::Ok || !isTransient(status) || attempt >= batch.options.retries) {
+			return status;
+		}
+		std::cerr << "Retrying " << input << " after: " << toString(status) << std::endl;
+		std::this_thread::sleep_for(std::chrono::milliseconds(200 << std::min(attempt, 5u)));
+	}
+}
+
+/**
+ * scan the tree and feed images to the workers as they are found, so the
+ * workers never wait for the whole tree to be enumerated.
+ */
+bool runBatch(Batch& batch, const std::string& inputDir, const std::string& outputDir, const FileFeed& feed) {
+	const Options& options = batch.options;
+	std::filesystem::path output(outputDir);
+	std::atomic<bool> stop(false);
+
+	auto job = [&batch, &options, &stop](const std::filesystem::path& path, const std::string& relative, const std::string& outputFilePath) {
+		if (stop) {
+			return;
+		}
+
+		FileStatus status = processWithRetries(batch, path, relative, outputFilePath);
+		if (status == FileStatus::Ok) {
+			batch.succeeded++;
+			if (batch.journal) {
+				batch.journal->record(relative);
+			}
+			if (options.verbose) {
+				std::cout << "Processed " << path << std::endl;
+			}
+			return;
+		}
+
+		std::cerr << "Failed to process image: " << path << ": " << toString(status) << std::endl;
+		batch.failed++;
+		if (batch.failures.is_open()) {
+			std::lock_guard<std::mutex> lock(batch.failuresMutex);
+			batch.failures << path.string() << '\t' << toString(status) << std::endl;
+		}
+		if (options.failFast) {
+			stop = true;
+		}
+	};
+
+	// bounded, a multi-million file tree shouldn't all end up queued in memory.
+	// declared after job, queued tasks refer to it and an exception from the scan
+	// has the pool finish them before job is gone
+	WorkerPool pool(options.threads, 1024);
+
+	// last output directory made for --mirror, only touched by the scanning thread
+	std::filesystem::path created;
+	bool mirror = options.mirror && options.detectOnly.empty();
+
+	auto queue = [&](const std::filesystem::path& path) {
+		if (stop) {
+			return false;
+		}
+		// reports, shards and the journal use paths relative to the input directory so they survive a different mount point
+		std::string relative = path.lexically_relative(batch.root).generic_string();
+
+		// the cheap checks first, files of other shards or finished before a restart are never opened
+		if (!inShard(relative, options)) {
+			return true;
+		}
+		if (batch.journal && batch.journal->done(relative)) {
+			batch.succeeded++;
+			return true;
+		}
+		if (!isImageFile(path)) {
+			return true;
+		}
+
+		std::filesystem::path outputFile = output / path.filename();
+		if (mirror) {
+			outputFile = output / path.lexically_relative(batch.root);
+			// a directory's files are scanned together, so each output directory is made once,
+			// here rather than in the workers so they never race to create it
+			if (outputFile.parent_path() != created) {
+				created = outputFile.parent_path();
+				std::error_code ec;
+				std::filesystem::create_directories(created, ec);
+				if (ec) {
+					std::cerr << "Failed to create output directory: " << created << ": " << ec.message() << std::endl;
+					stop = true;
+					return false;
+				}
+			}
+		}
+
+		pool.submit([&job, path, relative, outputFilePath = outputFile.string()] { job(path, relative, outputFilePath); });
+		return true;
+	};
+
+	// an output directory inside the input tree would feed our own results back in
+	bool scanned = scanDirectory(inputDir, options.recursive, output, queue);
+	bool fed = true;
+	if (scanned && feed) {
+		fed = feed(queue);
+	}
+
+	pool.wait();
+	return scanned && fed && !stop;
+}
+
+} // namespace
+
+
+bool processDirectory(const std::string& inputDir, const std::string& outputDir, const Options& options, BatchSummary* summary, const FileFeed& feed) {
+	Batch batch(inputDir, options);
+
+	if (!options.detectOnly.empty()) {
+		batch.report = std::make_unique<AngleReportWriter>();
+		if (!batch.report->open(options.detectOnly)) {
+			std::cerr << "Failed to open the report: " << options.detectOnly << std::endl;
+			return false;
+		}
+	}
+
+	if (!options.anglesFrom.empty() && !loadAngleReport(options.anglesFrom, batch.angles)) {
+		std::cerr << "Failed to read the angles from: " << options.anglesFrom << std::endl;
+		return false;
+	}
+
+	if (!options.manifest.empty() && options.detectOnly.empty()) {
+		batch.manifest = std::make_unique<Manifest>();
+		if (!batch.manifest->open(options.manifest)) {
+			std::cerr << "Failed to open the manifest: " << options.manifest << std::endl;
+			return false;
+		}
+	}
+
+	if (!options.journal.empty()) {
+		if (!options.detectOnly.empty()) {
+			// the report is rewritten from scratch every run, skipping images would lose their angles
+			std::cerr << "--journal can't be used with --detect-only" << std::endl;
+			return false;
+		}
+		batch.journal = std::make_unique<Journal>();
+		if (!batch.journal->open(options.journal, batch.optionsHash, options.resume)) {
+			std::cerr << "Failed to open the journal: " << options.journal << std::endl;
+			return false;
+		}
+		if (options.resume && options.verbose) {
+			std::cout << "Resuming, " << batch.journal->resumed() << " images already done" << std::endl;
+		}
+	}
+
+	if (!options.failureList.empty()) {
+		batch.failures.open(options.failureList, std::ios::trunc);
+		if (!batch.failures) {
+			std::cerr << "Failed to open the failure list: " << options.failureList << std::endl;
+			return false;
+		}
+	}
+
+	bool complete = runBatch(batch, inputDir, outputDir, feed);
+	if (batch.report && !batch.report->close()) {
+		std::cerr << "Failed to write the report: " << options.detectOnly << std::endl;
+		complete = false;
+	}
+	if (batch.journal) {
+		batch.journal->close();
+	}
+
+	if (batch.failed > 0) {
+		std::cerr << batch.failed << " of " << (batch.succeeded + batch.failed) << " images failed";
+		if (!options.failureList.empty()) {
+			std::cerr << ", listed in " << options.failureList;
+		}
+		std::cerr << std::endl;
+	}
+	else if (options.verbose) {
+		std::cout << "Processed " << batch.succeeded << " images" << std::endl;
+	}
+
+	if (summary) {
+		summary->succeeded = batch.succeeded;
+		summary->failed = batch.failed;
+		summary->complete = complete;
+	}
+	return complete && batch.failed == 0;
+}
+
+
+Deskewer::Deskewer(const Options& options) : options(options) {
+}
+
+double Deskewer::estimate(const cv::Mat& src) const {
+	return determineRotationAngle(src, options.detector);
+}
+
+double Deskewer::estimate(const cv::Mat& src, uint64_t contentHash) const {
+	return detect(src, contentHash).angle;
+}
+
+AngleEstimate Deskewer::detect(const cv::Mat& src, uint64_t contentHash) const {
+	if (!options.angleCache) {
+		return estimateRotation(src, options.detector);
+	}
+
+	uint64_t key = AngleCache::key(contentHash, options.detector, options.unchanged);
+	AngleEstimate estimate;
+	if (options.angleCache->find(key, estimate)) {
+		if (options.verbose) {
+			std::cout << "Using cached rotation angle" << std::endl;
+		}
+		return estimate;
+	}
+
+	estimate = estimateRotation(src, options.detector);
+	options.angleCache->store(key, estimate);
+	return estimate;
+}
+
+cv::Mat Deskewer::rotate(const cv::Mat& src, double angle) const {
+	return rotateImage(src, angle);
+}
+
+cv::Mat Deskewer::process(const cv::Mat& image, double* usedAngle) const {
+	return processImage(image, nullptr, usedAngle);
+}
+
+cv::Mat Deskewer::process(const cv::Mat& image, uint64_t contentHash, double* usedAngle) const {
+	return processImage(image, &contentHash, usedAngle);
+}
+
+cv::Mat Deskewer::processImage(const cv::Mat& image, const uint64_t* contentHash, double* usedAngle) const {
+	double angle = options.angle;
+	if (options.detect) {
+		angle = contentHash ? estimate(image, *contentHash) : estimate(image);
+		if (options.verbose) {
+			std::cout << "Rotation angle determined from image: " << angle << " degrees" << std::endl;
+		}
+	}
+	if (usedAngle) {
+		*usedAngle = angle;
+	}
+
+	// nothing to do, same as processSingleImage
+	if (angle == 0.0) {
+		return cv::Mat();
+	}
+
+	cv::Mat rotatedImage = rotate(image, angle);
+	if (rotatedImage.empty()) {
+		std::cerr << "Error rotating the image." << std::endl;
+	}
+	return rotatedImage;
+}
+
+namespace {
+
+/**
+ * whether the output's extension asks for the format the input already is in.
+ */
+bool keepsFormat(ImageFormat format, const std::string& outputFile) {
+	std::string extension = std::filesystem::path(outputFile).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	if (format == ImageFormat::Jpeg) {
+		return extension == ".jpg" || extension == ".jpeg" || extension == ".jpe";
+	}
+	if (format == ImageFormat::Tiff) {
+		return extension == ".tif" || extension == ".tiff";
+	}
+	return false;
+}
+
+/**
+ * turn an image by whole quarters through its exif orientation only, the
+ * pixels are copied as they are. over the input itself only the two bytes of
+ * the tag are written, when it already has one.
+ *
+ * @param encoded The input's contents.
+ * @param status Receives the outcome when it could be done this way.
+ * @return bool False if it can't: not whole quarters, not a jpeg or tiff written as the same format, or exif without an orientation tag. nothing is written then.
+ */
+bool rotateByMetadata(std::vector<uchar>& encoded, const std::string& inputFile, const std::string& outputFile, double angle, FileStatus& status) {
+	int quarters = (int)std::lround(angle / 90.0);
+	if (angle != 90.0 * quarters || !keepsFormat(sniffImageFormat(encoded.data(), encoded.size()), outputFile)) {
+		return false;
+	}
+
+	int current = readOrientation(encoded);
+	int orientation = turnOrientation(current, quarters);
+	size_t position = orientationPosition(encoded);
+	if (orientation != current && !writeOrientation(encoded, orientation)) {
+		return false;
+	}
+
+	std::error_code ec;
+	if (std::filesystem::equivalent(inputFile, outputFile, ec)) {
+		if (orientation == current) {
+			status = FileStatus::Ok;
+			return true;
+		}
+		if (position != 0) {
+			std::fstream file(inputFile, std::ios::in | std::ios::out | std::ios::binary);
+			file.seekp((std::streamoff)position);
+			file.write((const char*)&encoded[position], 2);
+			file.close();
+			status = file.fail() ? FileStatus::WriteFailed : FileStatus::Ok;
+			return true;
+		}
+	}
+	status = writeFileBytes(outputFile, encoded) ? FileStatus::Ok : FileStatus::WriteFailed;
+	return true;
+}
+
+} // namespace
+
+
+bool Deskewer::processFile(const std::string& inputFile, const std::string& outputFile, double* usedAngle) const {
+	return processFileStatus(inputFile, outputFile, usedAngle) == FileStatus::Ok;
+}
+
+FileStatus Deskewer::processFileStatus(const std::string& inputFile, const std::string& outputFile, double* usedAngle, uint64_t* contentHash) const {
+	// read and decode separately, so a flaky read can be told from a corrupt file
+	std::vector<uchar> encoded;
+	if (!readFileBytes(inputFile, encoded)) {
+		std::cerr << "Could not read the image: " << inputFile << std::endl;
+		return FileStatus::ReadFailed;
+	}
+
+	// before rotateByMetadata() changes the bytes
+	uint64_t hash = 0;
+	if (contentHash || (options.detect && options.angleCache)) {
+		hash = hashBytes(encoded.data(), encoded.size());
+		if (contentHash) {
+			*contentHash = hash;
+		}
+	}
+
+	// a fixed quarter turn doesn't need the pixels at all
+	FileStatus status;
+	if (options.metadataRotate && !options.detect && rotateByMetadata(encoded, inputFile, outputFile, options.angle, status)) {
+		if (usedAngle) {
+			*usedAngle = options.angle;
+		}
+		if (status != FileStatus::Ok) {
+			std::cerr << "Failed to write the image to: " << outputFile << std::endl;
+		}
+		else if (options.verbose) {
+			std::cout << "Image turned by its exif orientation and saved to " << outputFile << std::endl;
+		}
+		return status;
+	}
+
+	cv::Mat image = decodeImage(encoded, decodeFlags(options));
+	if (image.empty()) {
+		std::cerr << "Could not decode the image: " << inputFile << std::endl;
+		return FileStatus::DecodeFailed;
+	}
+
+	double angle = 0.0;
+	cv::Mat rotatedImage;
+	if (options.detect && options.angleCache) {
+		// the cache is keyed on the file contents, already in memory
+		rotatedImage = process(image, hash, &angle);
+	}
+	else {
+		rotatedImage = process(image, &angle);
+	}
+	if (usedAngle) {
+		*usedAngle = angle;
+	}
+
+	if (angle == 0.0) {
+		// already level, still written so the output has every image
+		rotatedImage = image;
+	}
+	else if (rotatedImage.empty()) {
+		return FileStatus::RotateFailed;
+	}
+
+	std::vector<uchar> result;
+	try {
+		encodeImage(std::filesystem::path(outputFile).extension().string(), rotatedImage, result, options.stripMetadata ? nullptr : &encoded);
+	}
+	catch (const cv::Exception& e) {
+		std::cerr << e.what() << std::endl;
+		result.clear();
+	}
+	if (result.empty()) {
+		std::cerr << "Failed to encode the image for: " << outputFile << std::endl;
+		return FileStatus::EncodeFailed;
+	}
+
+	if (!writeFileBytes(outputFile, result)) {
+		std::cerr << "Failed to write the image to: " << outputFile << std::endl;
+		return FileStatus::WriteFailed;
+	}
+
+	if (options.verbose) {
+		std::cout << "Image rotated successfully and saved to " << outputFile << std::endl;
+	}
+	return FileStatus::Ok;
+}
+
+} // namespace rotimage
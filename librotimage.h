@@ -0,0 +1,385 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// librotimage - rotate an image by an angle, optionally try to detect how far
+/// off it is from level ( needs an image with close to horizonal lines to work)
+///
+/// no global state, everything here is safe to call from multiple threads at
+/// once, so it can be used in-process instead of spawning rotImage per job.
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+class AngleCache;
+
+/**
+ * tuning for the line based angle detector, the defaults are what rotImage
+ * has always used.
+ */
+struct DetectorOptions {
+	double cannyLow = 50.0;
+	double cannyHigh = 150.0;
+	int houghThreshold = 100;
+	double minLineLength = 50.0;
+	double maxLineGap = 10.0;
+
+	// only look for lines in this part of the image, x,y,w,h. in pixels, or
+	// fractions of the image size when all four are <= 1.0. empty for all of it.
+	cv::Rect2d roi;
+
+	// pick the canny thresholds per image instead of using cannyLow / cannyHigh,
+	// so that only this fraction of pixels is strong enough to start an edge.
+	// keeps busy photos and faint scans to a similar amount of edges. 0 for off
+	double adaptiveEdgeFraction = 0.0;
+
+	// hand at most this many edge pixels to the line detector, evenly thinned
+	// out past that, so detection time is bounded whatever the image. 0 for no limit
+	int maxEdgePixels = 0;
+
+	// only look for lines within this many degrees of horizontal, with a
+	// standard hough over just that window at angleResolution steps, instead
+	// of the probabilistic one over every angle at 1 degree. 0 for the latter
+	double maxSkew = 0.0;
+	double angleResolution = 0.05;  // degrees, used with maxSkew
+
+	// with maxSkew, vote in horizontal bands of the image on every core instead
+	// of cv::HoughLines on one, for the latency of single huge images
+	bool parallelVoting = false;
+
+	// count near vertical lines as well, as skew by the same amount, so
+	// buildings, tables and text columns help instead of throwing the angle
+	// off. it's then only known modulo 90 degrees, between -45 and 45
+	bool verticals = false;
+
+	// also find pages that are on their side or upside down, from their text
+	// lines, and add the quarter turns to the angle. needs the skew precisely,
+	// so it implies verticals and refinement ( over 1 degree unless set )
+	bool orientation = false;
+
+	// then search this many degrees either side of the estimate for the angle
+	// the image's edges line up best at, for a few hundredths of a degree
+	// instead of the detector's steps. 0 for off
+	double refineWindow = 0.0;
+};
+
+/**
+ * settings for one job or batch. passed explicitly everywhere so several
+ * batches with different settings can run in the same process at once.
+ */
+struct Options {
+	double angle = 0.0;      // fixed angle to rotate by, ignored when detect is set
+	bool detect = false;     // detect the angle of every image individually
+	bool recursive = false;  // descend into subdirectories
+	bool failFast = false;   // stop a batch at the first image that fails instead of carrying on
+	unsigned retries = 2;    // extra attempts for images that failed to read or write
+	std::string failureList; // write the path of every image that failed here, with the reason
+	std::string journal;     // checkpoint every finished image here ...
+	bool resume = false;     // ... and skip the ones already in it, to carry on after the batch was killed
+	bool mirror = false;     // recreate the input subdirectories under the output directory instead of writing it flat
+	bool stripMetadata = false; // don't carry exif, colour profiles etc. over from jpeg inputs to jpeg outputs
+	bool metadataRotate = false; // turn jpegs and tiffs by a fixed whole number of quarters through their exif orientation, without decoding them
+	bool unchanged = false;  // decode with cv::IMREAD_UNCHANGED, 16 bit, float, gray and alpha are kept through to the output
+	bool verbose = false;
+	size_t threads = 0;      // worker threads for batches and daemons, 0 for one per core
+	std::string manifest;    // incremental mode, skip inputs unchanged since the run recorded here
+	std::string detectOnly;  // don't rotate, write path -> angle for every image to this .csv or .json report
+	std::string anglesFrom;  // rotate by the angles in this detect-only report instead of detecting
+	unsigned shard = 0;      // only handle the files that hash to this shard ...
+	unsigned shardCount = 1; // ... out of this many, see inShard()
+	DetectorOptions detector;
+
+	// shared between every job that gets a copy of these options, may be null
+	std::shared_ptr<AngleCache> angleCache;
+};
+
+/**
+ * read a whole file into memory.
+ *
+ * @param path The file to read.
+ * @param bytes Receives the contents.
+ * @return bool False if the file couldn't be read.
+ */
+bool readFileBytes(const std::string& path, std::vector<uchar>& bytes);
+
+/**
+ * write a whole file, atomically: anyone reading path, or a rerun after the
+ * process was killed, sees the old file or the complete new one, never half
+ * of it. not synced to disk, a power cut can still lose it.
+ *
+ * @param path The file to write, replaced if it exists.
+ * @param bytes The contents.
+ * @return bool False if the file couldn't be written.
+ */
+bool writeFileBytes(const std::string& path, const std::vector<uchar>& bytes);
+
+/**
+ * decode an image the right way up. for jpeg, tiff and png the exif
+ * orientation is read from the header and applied explicitly, whatever the
+ * flags, so every path sees the same pixels and no output is ever turned
+ * twice. other formats are turned by opencv, as far as it does.
+ *
+ * @param bytes The encoded image.
+ * @param flags cv::imdecode() flags.
+ * @return cv::Mat The image, empty if it couldn't be decoded.
+ */
+cv::Mat decodeImage(const std::vector<uchar>& bytes, int flags = cv::IMREAD_COLOR);
+
+/**
+ * @param options Run options.
+ * @return int The decodeImage() flags for them, see options.unchanged.
+ */
+int decodeFlags(const Options& options);
+
+/**
+ * encode an image, keeping the metadata of the original when both are jpeg.
+ * its orientation is reset, the pixels were already turned by decodeImage().
+ * 16 bit and float images going to an 8 bit only format like jpeg are scaled
+ * down to it, opencv would clip them.
+ *
+ * @param extension Format to encode to, e.g. ".jpg".
+ * @param image The image.
+ * @param encoded Receives the encoded image.
+ * @param original Optional, the encoded image it was made from, for its metadata.
+ * @return bool False if opencv can't encode to the extension.
+ */
+bool encodeImage(const std::string& extension, const cv::Mat& image, std::vector<uchar>& encoded, const std::vector<uchar>* original = nullptr);
+
+/**
+ * check if a file is an image opencv can read, going by its first bytes
+ * rather than its extension, so nothing is decoded just to find out.
+ *
+ * @param path The file path.
+ * @return bool True if the file is an image, false otherwise.
+ */
+bool isImageFile(const std::filesystem::path& path);
+
+/**
+ * whether a file belongs to options.shard of options.shardCount. decided by a
+ * hash of the path relative to the input directory, so every process sharing
+ * the tree ( e.g. over nfs ) agrees without talking to each other, and each
+ * file is handled by exactly one of them.
+ *
+ * @param relativePath Path relative to the input directory, with / separators.
+ * @param options shard and shardCount.
+ * @return bool True if this process should handle the file.
+ */
+bool inShard(const std::string& relativePath, const Options& options);
+
+/**
+ * result of the angle detector.
+ */
+struct AngleEstimate {
+	double angle = 0.0;       // degrees
+	double confidence = 0.0;  // fraction of the lines within a degree of angle, 0 when none were found
+	int lines = 0;            // number of lines the estimate is based on
+};
+
+/**
+ * automatically try to determine the rotation angle of an image, and how much
+ * to trust it.
+ *
+ * @param src The source image, any depth, gray or colour, with or without alpha.
+ * @param detector Detector tuning.
+ * @return AngleEstimate The estimated rotation angle in degrees with its confidence.
+ */
+AngleEstimate estimateRotation(const cv::Mat& src, const DetectorOptions& detector = DetectorOptions());
+
+/**
+ * automatically try to determine the rotation angle of an image.
+ *
+ * @param src The source image.
+ * @param detector Detector tuning.
+ * @return double The estimated rotation angle in degrees.
+ */
+double determineRotationAngle(const cv::Mat& src, const DetectorOptions& detector = DetectorOptions());
+
+/**
+ * calculate the rotation angle from a reference image.
+ *
+ * @param referenceImagePath Path to the reference image.
+ * @param successful Reference to a boolean flag indicating success or failure.
+ * @param options Detector tuning and verbosity.
+ * @return double The calculated rotation angle.
+ */
+double calculateReferenceAngle(const std::string& referenceImagePath, bool& successful, const Options& options);
+
+/**
+ * rotate an image by a given angle, the canvas grows to fit. whole quarter
+ * turns are lossless, only the rest of the angle is interpolated. any depth
+ * and number of channels, with alpha the corners are transparent.
+ *
+ * @param src The source image to be rotated.
+ * @param angle The angle in degrees to rotate the image.
+ * @return cv::Mat The rotated image.
+ */
+cv::Mat rotateImage(const cv::Mat& src, double angle);
+
+/**
+ * process a single image file - rotate and save it, by options.angle even if
+ * options.detect is set. an angle of 0.0 saves it unrotated.
+ * with options.metadataRotate, quarter turns of jpegs and tiffs only change
+ * their exif orientation.
+ *
+ * @param inputFile The path of the input image file.
+ * @param outputFile The path where the output image will be saved.
+ * @param options options.angle is the angle to rotate the image by.
+ * @return bool Status code (true for success, false for error).
+ */
+bool processSingleImage(const std::string& inputFile, const std::string& outputFile, const Options& options);
+
+/**
+ * how processing one file went, so a corrupt image can be told from a flaky
+ * disk or network mount.
+ */
+enum class FileStatus {
+	Ok,
+	ReadFailed,    // the input couldn't be read, may work if retried
+	DecodeFailed,  // not an image opencv can decode
+	RotateFailed,
+	EncodeFailed,  // opencv can't encode to the output's extension
+	WriteFailed,   // the output couldn't be written, may work if retried
+};
+
+/**
+ * @param status The outcome of one file.
+ * @return bool True if trying the same file again might succeed.
+ */
+bool isTransient(FileStatus status);
+
+/**
+ * @param status The outcome of one file.
+ * @return const char* Short description for logs and failure lists.
+ */
+const char* toString(FileStatus status);
+
+/**
+ * what one processDirectory call got through.
+ */
+struct BatchSummary {
+	size_t succeeded = 0;   // written, detected, or skipped as already done
+	size_t failed = 0;      // still failing after the retries
+	bool complete = false;  // the whole tree was scanned and every image attempted
+};
+
+/**
+ * images that turn up after the scan, e.g. from a watch on the directory.
+ * runs on the calling thread and hands every new file to onFile, which returns
+ * false once the batch is stopping. returns false on an error, when it ran out
+ * of files otherwise.
+ */
+using FileFeed = std::function<bool(const std::function<bool(const std::filesystem::path&)>& onFile)>;
+
+/**
+ * process all images in a directory. recursively as an option.
+ *
+ * the tree is scanned while options.threads workers process what has been
+ * found so far. an image that fails is retried if the failure looks
+ * transient, then listed in options.failureList and skipped, unless
+ * options.failFast is set. only the files in
+ * options.shard are processed when options.shardCount is more than 1.
+ * outputs go straight into outputDir, so same named files in different
+ * subdirectories overwrite each other, unless options.mirror is set.
+ *
+ * @param inputDir The input directory path.
+ * @param outputDir The output directory path.
+ * @param options Angle or detection, recursion and verbosity for this batch.
+ * @param summary Optional, receives the counts, e.g. to tell a batch that couldn't run from one with a few bad images.
+ * @param feed Optional, more files of inputDir to process after the scan, exactly like the scanned ones.
+ * @return bool True if every image was processed.
+ */
+bool processDirectory(const std::string& inputDir, const std::string& outputDir, const Options& options, BatchSummary* summary = nullptr, const FileFeed& feed = nullptr);
+
+
+/**
+ * reusable entry point for callers that want to deskew many images in-process.
+ *
+ * holds no mutable state, a single instance can be shared between threads.
+ */
+class Deskewer {
+public:
+	explicit Deskewer(const Options& options = Options());
+
+	/**
+	 * estimate how far off level an already decoded image is.
+	 *
+	 * @param src The source image.
+	 * @return double The estimated rotation angle in degrees.
+	 */
+	double estimate(const cv::Mat& src) const;
+
+	/**
+	 * same, but looks in options.angleCache first and stores new estimates there.
+	 *
+	 * @param src The source image.
+	 * @param contentHash hashBytes() of the encoded image src was decoded from.
+	 * @return double The estimated rotation angle in degrees.
+	 */
+	double estimate(const cv::Mat& src, uint64_t contentHash) const;
+
+	/**
+	 * the whole estimate with its confidence, through options.angleCache like estimate().
+	 *
+	 * @param src The source image.
+	 * @param contentHash hashBytes() of the encoded image src was decoded from, unused without a cache.
+	 * @return AngleEstimate The estimated rotation angle in degrees with its confidence.
+	 */
+	AngleEstimate detect(const cv::Mat& src, uint64_t contentHash) const;
+
+	/**
+	 * rotate an already decoded image.
+	 *
+	 * @param src The source image to be rotated.
+	 * @param angle The angle in degrees to rotate the image.
+	 * @return cv::Mat The rotated image.
+	 */
+	cv::Mat rotate(const cv::Mat& src, double angle) const;
+
+	/**
+	 * detect the angle ( when options.detect is set ) and rotate an already
+	 * decoded image.
+	 *
+	 * @param image The source image.
+	 * @param usedAngle Optional, receives the angle that was actually applied.
+	 * @return cv::Mat The rotated image, empty on error or when the angle is 0.0.
+	 */
+	cv::Mat process(const cv::Mat& image, double* usedAngle = nullptr) const;
+
+	/**
+	 * same, with the content hash of the encoded image so the angle cache can be used.
+	 */
+	cv::Mat process(const cv::Mat& image, uint64_t contentHash, double* usedAngle = nullptr) const;
+
+	/**
+	 * read, rotate and write one image, the file is only decoded once.
+	 * the angle is detected from the image itself when options.detect is set.
+	 * an image that is already level is written unrotated.
+	 *
+	 * @param inputFile The path of the input image file.
+	 * @param outputFile The path where the output image will be saved.
+	 * @param usedAngle Optional, receives the angle that was actually applied.
+	 * @return bool Status code (true for success, false for error).
+	 */
+	bool processFile(const std::string& inputFile, const std::string& outputFile, double* usedAngle = nullptr) const;
+
+	/**
+	 * same, but says what went wrong so the caller can decide whether to retry.
+	 *
+	 * @param contentHash Optional, receives hashBytes() of the file as it was read, for the manifest.
+	 */
+	FileStatus processFileStatus(const std::string& inputFile, const std::string& outputFile, double* usedAngle = nullptr, uint64_t* contentHash = nullptr) const;
+
+private:
+	cv::Mat processImage(const cv::Mat& image, const uint64_t* contentHash, double* usedAngle) const;
+
+	Options options;
+};
+
+} // namespace rotimage
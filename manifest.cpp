@@ -0,0 +1,148 @@
+#include "manifest.h"
+#include "hashing.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+namespace rotimage {
+
+namespace {
+
+const char* header = "# rotImage manifest v1";
+
+bool parseLine(const std::string& line, std::string& input, ManifestEntry& entry) {
+	std::vector<std::string> fields;
+	size_t start = 0;
+	// the input path is last and keeps any tabs it has
+	while (fields.size() < 6) {
+		size_t tab = line.find('\t', start);
+		if (tab == std::string::npos) {
+			return false;
+		}
+		fields.push_back(line.substr(start, tab - start));
+		start = tab + 1;
+	}
+	input = line.substr(start);
+
+	try {
+		entry.size = std::stoull(fields[0]);
+		entry.mtime = std::stoll(fields[1]);
+		entry.angle = std::stod(fields[4]);
+	}
+	catch (const std::exception&) {
+		return false;
+	}
+	entry.output = fields[5];
+	return fromHex(fields[2], entry.contentHash) && fromHex(fields[3], entry.optionsHash) && !input.empty();
+}
+
+std::string formatLine(const std::string& input, const ManifestEntry& entry) {
+	std::ostringstream line;
+	line.precision(17);
+	line << entry.size << '\t' << entry.mtime << '\t' << toHex(entry.contentHash) << '\t' << toHex(entry.optionsHash) << '\t'
+		<< entry.angle << '\t' << entry.output << '\t' << input << '\n';
+	return line.str();
+}
+
+} // namespace
+
+
+bool Manifest::open(const std::string& path) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::ifstream existing(path);
+	std::string line;
+	while (std::getline(existing, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		std::string input;
+		ManifestEntry entry;
+		if (parseLine(line, input, entry)) {
+			entries[input] = entry;
+		}
+	}
+	existing.close();
+
+	// compact, latest record per input only
+	std::string compacted = path + ".tmp";
+	{
+		std::ofstream out(compacted, std::ios::trunc);
+		out << header << '\n';
+		for (const auto& entry : entries) {
+			out << formatLine(entry.first, entry.second);
+		}
+		if (!out) {
+			std::cerr << "Failed to write the manifest: " << compacted << std::endl;
+			return false;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(compacted, path, ec);
+	if (ec) {
+		std::cerr << "Failed to replace the manifest: " << path << ": " << ec.message() << std::endl;
+		return false;
+	}
+
+	file.open(path, std::ios::app);
+	return file.is_open();
+}
+
+bool Manifest::check(const std::filesystem::path& input, const std::string& outputFile, uint64_t optionsHash, ManifestEntry& current) {
+	std::error_code ec;
+	current = ManifestEntry();
+	current.size = std::filesystem::file_size(input, ec);
+	current.mtime = std::filesystem::last_write_time(input, ec).time_since_epoch().count();
+	current.optionsHash = optionsHash;
+	if (ec) {
+		return false;
+	}
+
+	ManifestEntry previous;
+	bool known;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = entries.find(input.string());
+		known = found != entries.end();
+		if (known) {
+			previous = found->second;
+		}
+	}
+
+	// written by this run's settings to where this run writes, another -o or --mirror has to start over
+	bool usable = known && previous.optionsHash == optionsHash && previous.output == outputFile && std::filesystem::exists(outputFile, ec);
+	if (!usable || previous.size != current.size) {
+		return false;
+	}
+	if (previous.mtime == current.mtime) {
+		current = previous;
+		return true;
+	}
+
+	if (!hashFile(input, current.contentHash)) {
+		return false;
+	}
+
+	// touched, but the same bytes
+	if (previous.contentHash == current.contentHash) {
+		current.angle = previous.angle;
+		current.output = previous.output;
+		record(input, current);
+		return true;
+	}
+	return false;
+}
+
+void Manifest::record(const std::filesystem::path& input, const ManifestEntry& entry) {
+	std::lock_guard<std::mutex> lock(mutex);
+	entries[input.string()] = entry;
+	append(input.string(), entry);
+}
+
+void Manifest::append(const std::string& input, const ManifestEntry& entry) {
+	file << formatLine(input, entry);
+	file.flush();
+}
+
+} // namespace rotimage
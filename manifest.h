@@ -0,0 +1,76 @@
+#pragma once
+
+#include "librotimage.h"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// incremental re-runs, remembers what every input looked like when it was last
+/// processed so unchanged files can be skipped on the next run.
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+struct ManifestEntry {
+	uint64_t size = 0;
+	int64_t mtime = 0;
+	uint64_t contentHash = 0;
+	uint64_t optionsHash = 0;
+	double angle = 0.0;
+	std::string output;
+};
+
+/**
+ * one tab separated line per input: size, mtime, content hash, options hash,
+ * angle, output path, input path. records are appended as images finish so an
+ * interrupted run keeps what it did, opening compacts the file down to the
+ * latest record per input. safe to use from multiple threads.
+ */
+class Manifest {
+public:
+	/**
+	 * load an existing manifest ( a missing one is fine ) and open it for appending.
+	 *
+	 * @param path The manifest file.
+	 * @return bool False if it couldn't be written.
+	 */
+	bool open(const std::string& path);
+
+	/**
+	 * check if input was processed to the same output with the same settings
+	 * last time and hasn't changed since. only size and mtime are compared at
+	 * first, the content is hashed when just the mtime differs ( a touched but
+	 * identical file is still skipped ). a file that has to be processed isn't
+	 * read here, the caller hashes the bytes it reads anyway, see
+	 * Deskewer::processFileStatus(). only a touched file that did change is
+	 * read twice.
+	 *
+	 * @param input The input image.
+	 * @param outputFile Where the current run writes it, a record of another output doesn't count.
+	 * @param optionsHash hashOptions() of the current settings.
+	 * @param current Receives what input looks like now, pass it to record() after processing with the content hash filled in.
+	 * @return bool True if input can be skipped.
+	 */
+	bool check(const std::filesystem::path& input, const std::string& outputFile, uint64_t optionsHash, ManifestEntry& current);
+
+	/**
+	 * remember that input was processed.
+	 *
+	 * @param input The input image, as given to check().
+	 * @param entry What check() filled in, plus the angle and output path.
+	 */
+	void record(const std::filesystem::path& input, const ManifestEntry& entry);
+
+private:
+	void append(const std::string& input, const ManifestEntry& entry);
+
+	std::mutex mutex;
+	std::unordered_map<std::string, ManifestEntry> entries;
+	std::ofstream file;
+};
+
+} // namespace rotimage
@@ -0,0 +1,147 @@
+#include "orientation.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace rotimage {
+
+namespace {
+
+// long side of the copy that is classified, letters need a few pixels for their ascenders to show
+const int pageSize = 1200;
+
+// how clearly one answer has to win, otherwise the page is left as it is
+const double sideMargin = 1.5;
+const double upMargin = 1.2;
+
+std::vector<double> rowProfile(const cv::Mat& ink) {
+	std::vector<double> profile(ink.rows, 0.0);
+	for (int y = 0; y < ink.rows; y++) {
+		const uchar* row = ink.ptr<uchar>(y);
+		for (int x = 0; x < ink.cols; x++) {
+			profile[y] += row[x];
+		}
+	}
+	return profile;
+}
+
+std::vector<double> columnProfile(const cv::Mat& ink) {
+	std::vector<double> profile(ink.cols, 0.0);
+	for (int y = 0; y < ink.rows; y++) {
+		const uchar* row = ink.ptr<uchar>(y);
+		for (int x = 0; x < ink.cols; x++) {
+			profile[x] += row[x];
+		}
+	}
+	return profile;
+}
+
+/**
+ * how much the profile jumps from one entry to the next, relative to its size.
+ * high across text lines, low along them.
+ */
+double sharpness(const std::vector<double>& profile) {
+	double jumps = 0.0;
+	double energy = 0.0;
+	for (size_t i = 0; i < profile.size(); i++) {
+		energy += profile[i] * profile[i];
+		if (i > 0) {
+			jumps += (profile[i] - profile[i - 1]) * (profile[i] - profile[i - 1]);
+		}
+	}
+	return energy > 0.0 ? jumps / energy : 0.0;
+}
+
+/**
+ * split each text line in the row profile into its core, the rows with at
+ * least half its peak ink, and add up the ink above and below that.
+ */
+void lineZones(const std::vector<double>& rows, double& above, double& below) {
+	above = 0.0;
+	below = 0.0;
+	double peak = *std::max_element(rows.begin(), rows.end());
+	int count = (int)rows.size();
+	for (int y = 0; y < count;) {
+		if (rows[y] <= 0.1 * peak) {
+			y++;
+			continue;
+		}
+		int start = y;
+		while (y < count && rows[y] > 0.1 * peak) {
+			y++;
+		}
+		// too thin for a line of text, rules and specks
+		if (y - start < 4) {
+			continue;
+		}
+
+		double linePeak = *std::max_element(rows.begin() + start, rows.begin() + y);
+		int coreStart = start;
+		while (rows[coreStart] < 0.5 * linePeak) {
+			coreStart++;
+		}
+		int coreEnd = y - 1;
+		while (rows[coreEnd] < 0.5 * linePeak) {
+			coreEnd--;
+		}
+		for (int i = start; i < coreStart; i++) {
+			above += rows[i];
+		}
+		for (int i = coreEnd + 1; i < y; i++) {
+			below += rows[i];
+		}
+	}
+}
+
+} // namespace
+
+
+int detectOrientation(const cv::Mat& gray, double skew) {
+	if (gray.empty()) {
+		return 0;
+	}
+	cv::Mat small = gray;
+	double scale = (double)pageSize / std::max(gray.cols, gray.rows);
+	if (scale < 1.0) {
+		cv::resize(gray, small, cv::Size(), scale, scale, cv::INTER_AREA);
+	}
+
+	// level it, same size, the corners are filled from the edges so they don't turn into ink
+	cv::Mat level;
+	cv::Point2f center(small.cols / 2.0f, small.rows / 2.0f);
+	cv::warpAffine(small, level, cv::getRotationMatrix2D(center, skew, 1.0), small.size(), cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+
+	// dark text on light paper
+	cv::Mat ink;
+	cv::threshold(level, ink, 0, 1, cv::THRESH_BINARY_INV | cv::THRESH_OTSU);
+
+	std::vector<double> rows = rowProfile(ink);
+	double rowSharpness = sharpness(rows);
+	double columnSharpness = sharpness(columnProfile(ink));
+
+	int turn = 0;
+	if (columnSharpness > sideMargin * rowSharpness) {
+		// on its side, turn it a quarter clockwise and find out which way up that is
+		cv::Mat turned;
+		cv::rotate(ink, turned, cv::ROTATE_90_CLOCKWISE);
+		rows = rowProfile(turned);
+		turn = -90;
+	}
+	else if (rowSharpness <= sideMargin * columnSharpness) {
+		// no clear text lines either way
+		return 0;
+	}
+
+	double above, below;
+	lineZones(rows, above, below);
+	if (below > upMargin * above) {
+		return turn + 180;
+	}
+	if (above > upMargin * below) {
+		return turn;
+	}
+	// lines but no telling which way up, better not to turn it at all than half the time the wrong way
+	return 0;
+}
+
+} // namespace rotimage
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// which way up a scanned page is, for feeders that put pages in on their side
+/// or upside down. the skew detectors only know angles modulo 90 degrees.
+///
+/// once the page is level its text lines make the ink profile down the rows
+/// sharp and the one across the columns flat, or the other way round when the
+/// page is on its side. which way up is told by the ink just above and below
+/// the core of each line: latin text has far more ascenders ( capitals, b d f
+/// h k l t, digits ) than descenders ( g j p q y ).
+///
+/// both need the skew to within a tenth of a degree or so, or the lines blur
+/// into each other across the page.
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+/**
+ * @param gray Grayscale page, or the part of it the detector looked at.
+ * @param skew Its skew in degrees, see refineAngle(), the page is levelled by this first.
+ * @return int Degrees to turn it by on top of the skew to put it upright, 0, 90, 180 or -90. 0 when it can't tell.
+ */
+int detectOrientation(const cv::Mat& gray, double skew);
+
+} // namespace rotimage
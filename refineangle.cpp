@@ -0,0 +1,177 @@
+#include "refineangle.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace rotimage {
+
+namespace {
+
+// long side of the copy the profile is taken from, enough for a few hundredths of a degree on a page
+const int profileSize = 800;
+
+// only the strongest gradients vote, the rest is mostly paper and noise
+const double strongFraction = 0.1;
+
+// steps of the coarse scan either side of the estimate, then search until the bracket is this narrow
+const int scanSteps = 4;
+const double tolerance = 0.01;
+
+struct Sample {
+	float x;  // from the center of the image
+	float y;
+	float weight;
+};
+
+/**
+ * the strong gradients of a small copy of gray. the vertical ones for
+ * horizontal edges, and with verticals the horizontal ones for vertical edges,
+ * turned a quarter so they line up at the same angles.
+ */
+struct Gradients {
+	std::vector<Sample> rows;
+	std::vector<Sample> columns;
+};
+
+Gradients strongGradients(const cv::Mat& gray, bool verticals) {
+	cv::Mat small = gray;
+	double scale = (double)profileSize / std::max(gray.cols, gray.rows);
+	if (scale < 1.0) {
+		cv::resize(gray, small, cv::Size(), scale, scale, cv::INTER_AREA);
+	}
+
+	// horizontal edges are what should line up, so only the change from row to row
+	cv::Mat dy, dx;
+	cv::Sobel(small, dy, CV_32F, 0, 1, 3);
+	if (verticals) {
+		cv::Sobel(small, dx, CV_32F, 1, 0, 3);
+	}
+	std::vector<float> magnitudes;
+	magnitudes.reserve(dy.total() + dx.total());
+	for (cv::Mat* gradient : {&dy, &dx}) {
+		for (int y = 0; y < gradient->rows; y++) {
+			float* row = gradient->ptr<float>(y);
+			for (int x = 0; x < gradient->cols; x++) {
+				row[x] = std::abs(row[x]);
+				magnitudes.push_back(row[x]);
+			}
+		}
+	}
+
+	// one threshold for both, a picture without verticals shouldn't get its noise counted
+	size_t strongest = std::min(magnitudes.size() - 1, (size_t)(strongFraction * magnitudes.size()));
+	std::nth_element(magnitudes.begin(), magnitudes.begin() + strongest, magnitudes.end(), std::greater<float>());
+	float threshold = std::max(magnitudes[strongest], 1.0f);
+
+	Gradients gradients;
+	float centerX = small.cols / 2.0f;
+	float centerY = small.rows / 2.0f;
+	for (int y = 0; y < dy.rows; y++) {
+		const float* row = dy.ptr<float>(y);
+		for (int x = 0; x < dy.cols; x++) {
+			if (row[x] >= threshold) {
+				gradients.rows.push_back({x - centerX, y - centerY, row[x]});
+			}
+		}
+	}
+	for (int y = 0; y < dx.rows; y++) {
+		const float* row = dx.ptr<float>(y);
+		for (int x = 0; x < dx.cols; x++) {
+			if (row[x] >= threshold) {
+				// a quarter turn takes a line at 90 + a degrees to a
+				gradients.columns.push_back({y - centerY, centerX - x, row[x]});
+			}
+		}
+	}
+	return gradients;
+}
+
+/**
+ * sharpness of the profile across lines at this angle, split between the two
+ * nearest rows so the score changes smoothly with the angle.
+ */
+double profileScore(const std::vector<Sample>& samples, double degrees, std::vector<double>& profile) {
+	double radians = degrees * CV_PI / 180.0;
+	double c = std::cos(radians);
+	double s = std::sin(radians);
+	// every sample is within half the profile of the center
+	double offset = profile.size() / 2.0;
+
+	std::fill(profile.begin(), profile.end(), 0.0);
+	for (const auto& sample : samples) {
+		double position = sample.y * c - sample.x * s + offset;
+		int row = (int)position;
+		double fraction = position - row;
+		profile[row] += sample.weight * (1.0 - fraction);
+		profile[row + 1] += sample.weight * fraction;
+	}
+
+	double score = 0.0;
+	for (double value : profile) {
+		score += value * value;
+	}
+	return score;
+}
+
+} // namespace
+
+
+double refineAngle(const cv::Mat& gray, double coarse, double window, bool verticals) {
+	if (gray.empty() || window <= 0.0) {
+		return coarse;
+	}
+	Gradients gradients = strongGradients(gray, verticals);
+	if (gradients.rows.empty() && gradients.columns.empty()) {
+		return coarse;
+	}
+
+	// both turn about the center, so this covers the columns as well
+	double reach = std::hypot(gray.cols, gray.rows) / 2.0 * std::min(1.0, (double)profileSize / std::max(gray.cols, gray.rows));
+	std::vector<double> profile(2 * (size_t)std::ceil(reach) + 4, 0.0);
+
+	double best = coarse;
+	double bestScore = -1.0;
+	auto score = [&](double degrees) {
+		// separate profiles, the rows and the columns line up independently
+		double value = profileScore(gradients.rows, degrees, profile) + profileScore(gradients.columns, degrees, profile);
+		if (value > bestScore) {
+			best = degrees;
+			bestScore = value;
+		}
+		return value;
+	};
+
+	// the score has a sharp peak and is bumpy away from it, a scan first so the search starts next to the right one
+	double step = window / scanSteps;
+	for (int i = -scanSteps; i <= scanSteps; i++) {
+		score(coarse + i * step);
+	}
+	double low = std::max(best - step, coarse - window);
+	double high = std::min(best + step, coarse + window);
+
+	const double ratio = (std::sqrt(5.0) - 1.0) / 2.0;
+	double a = high - ratio * (high - low);
+	double b = low + ratio * (high - low);
+	double scoreA = score(a);
+	double scoreB = score(b);
+	while (high - low > tolerance) {
+		if (scoreA > scoreB) {
+			high = b;
+			b = a;
+			scoreB = scoreA;
+			a = high - ratio * (high - low);
+			scoreA = score(a);
+		}
+		else {
+			low = a;
+			a = b;
+			scoreA = scoreB;
+			b = low + ratio * (high - low);
+			scoreB = score(b);
+		}
+	}
+	return best;
+}
+
+} // namespace rotimage
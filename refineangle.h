@@ -0,0 +1,32 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// second pass for the angle detectors. the hough ones are limited by their
+/// angle steps and by how the lines they find are averaged, this one starts
+/// from their estimate and searches a small window around it for the angle at
+/// which the image's horizontal edges line up best.
+///
+/// an angle is scored by projecting the strong vertical gradients of a small
+/// copy of the image onto the axis at right angles to it: level text lines and
+/// rules pile up into a few sharp rows of the profile, and the sum of its
+/// squares is highest when they do. a coarse scan over the window, then a
+/// golden section search around the best step.
+///
+/// with verticals the vertical edges are scored the same way, on a profile of
+/// their own along the other axis.
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+/**
+ * @param gray Grayscale image, or the part of it the detector looked at.
+ * @param coarse The detector's estimate, in degrees.
+ * @param window Degrees either side of coarse to search.
+ * @param verticals Line up the vertical edges as well, see DetectorOptions::verticals.
+ * @return double The refined angle in degrees, coarse when there's nothing to line up.
+ */
+double refineAngle(const cv::Mat& gray, double coarse, double window, bool verticals = false);
+
+} // namespace rotimage
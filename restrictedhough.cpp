@@ -0,0 +1,209 @@
+#include "restrictedhough.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+namespace rotimage {
+
+namespace {
+
+int angleSteps(const DetectorOptions& detector) {
+	return (int)std::lround(2.0 * detector.maxSkew / detector.angleResolution) + 1;
+}
+
+double stepAngle(double step, const DetectorOptions& detector) {
+	return step * detector.angleResolution - detector.maxSkew;
+}
+
+/**
+ * the best step, with a parabola through it and its neighbours for the part in between.
+ */
+double peakStep(const std::vector<double>& scores) {
+	int peak = (int)(std::max_element(scores.begin(), scores.end()) - scores.begin());
+	double offset = 0.0;
+	if (peak > 0 && peak < (int)scores.size() - 1) {
+		double curvature = scores[peak - 1] - 2.0 * scores[peak] + scores[peak + 1];
+		if (curvature < 0.0) {
+			offset = 0.5 * (scores[peak - 1] - scores[peak + 1]) / curvature;
+		}
+	}
+	return peak + offset;
+}
+
+/**
+ * distances x cos + y sin of every pixel in rows y0 to y1, for the normals in the window.
+ */
+struct RhoRange {
+	RhoRange(int y0, int y1, int width, double skew)
+		: min((int)std::floor(y0 * std::cos(skew) - width * std::sin(skew)) - 1), max((int)std::ceil(y1 + width * std::sin(skew)) + 1) {
+	}
+
+	int size() const {
+		return max - min + 1;
+	}
+
+	int min;
+	int max;
+};
+
+/**
+ * a line found in the window, the angle of the line itself rather than its normal.
+ */
+struct Line {
+	double degrees;
+	double votes;
+};
+
+/**
+ * cv::HoughLines limited to the window, the lines added to found.
+ *
+ * @param sign -1 for a transposed edge map, its near vertical lines come out mirrored.
+ */
+void houghLines(const cv::Mat& edges, int houghThreshold, const DetectorOptions& detector, double sign, std::vector<Line>& found) {
+	// hough works with the line normals, a horizontal line's is at 90 degrees
+	double skew = detector.maxSkew * CV_PI / 180.0;
+	std::vector<cv::Vec3f> lines;
+	cv::HoughLines(edges, lines, 1, detector.angleResolution * CV_PI / 180.0, houghThreshold, 0, 0, CV_PI / 2 - skew, CV_PI / 2 + skew);
+	for (const auto& line : lines) {
+		found.push_back({sign * (line[1] * (180.0 / CV_PI) - 90.0), line[2]});
+	}
+}
+
+/**
+ * the same vote, split into horizontal bands that each fill their own
+ * accumulator on one core and add it to the shared one at the end. lines are
+ * picked like cv::HoughLines does: cells over the threshold that beat their
+ * neighbours in distance and angle, so one strong line isn't counted again
+ * at every cell next to it.
+ */
+void bandedLines(const cv::Mat& edges, int houghThreshold, const DetectorOptions& detector, double sign, std::vector<Line>& found) {
+	// the steps are rounded to a whole number, the last one can lie a little past maxSkew
+	int steps = angleSteps(detector);
+	double skew = std::max(std::abs(stepAngle(0, detector)), std::abs(stepAngle(steps - 1, detector))) * CV_PI / 180.0;
+	std::vector<float> cosines(steps);
+	std::vector<float> sines(steps);
+	for (int t = 0; t < steps; t++) {
+		double theta = CV_PI / 2 + stepAngle(t, detector) * CV_PI / 180.0;
+		cosines[t] = (float)std::cos(theta);
+		sines[t] = (float)std::sin(theta);
+	}
+
+	// laid out one row of distances per angle step
+	RhoRange all(0, edges.rows, edges.cols, skew);
+	std::vector<int> accumulator((size_t)steps * all.size(), 0);
+	std::mutex mutex;
+
+	int bands = std::max(1, std::min(cv::getNumThreads(), edges.rows));
+	cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+		for (int band = range.start; band < range.end; band++) {
+			int y0 = (int)((int64_t)edges.rows * band / bands);
+			int y1 = (int)((int64_t)edges.rows * (band + 1) / bands);
+			RhoRange local(y0, y1, edges.cols, skew);
+			std::vector<int> votes((size_t)steps * local.size(), 0);
+
+			for (int y = y0; y < y1; y++) {
+				const uchar* row = edges.ptr<uchar>(y);
+				for (int x = 0; x < edges.cols; x++) {
+					if (!row[x]) {
+						continue;
+					}
+					int* distances = votes.data();
+					for (int t = 0; t < steps; t++, distances += local.size()) {
+						int r = cvRound(x * cosines[t] + y * sines[t]) - local.min;
+						assert(r >= 0 && r < local.size());
+						distances[r]++;
+					}
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			for (int t = 0; t < steps; t++) {
+				int* target = accumulator.data() + (size_t)t * all.size() + (local.min - all.min);
+				const int* source = votes.data() + (size_t)t * local.size();
+				for (int r = 0; r < local.size(); r++) {
+					target[r] += source[r];
+				}
+			}
+		}
+	});
+
+	// the same comparisons as opencv, strictly greater than the neighbours before, at least those after, 0 outside
+	auto votes = [&](int t, int r) {
+		return t < 0 || t >= steps || r < 0 || r >= all.size() ? 0 : accumulator[(size_t)t * all.size() + r];
+	};
+	for (int t = 0; t < steps; t++) {
+		for (int r = 0; r < all.size(); r++) {
+			int cell = votes(t, r);
+			if (cell > houghThreshold && cell > votes(t, r - 1) && cell >= votes(t, r + 1) && cell > votes(t - 1, r) && cell >= votes(t + 1, r)) {
+				found.push_back({sign * stepAngle(t, detector), (double)cell});
+			}
+		}
+	}
+}
+
+/**
+ * the lines of edges, and with detector.verticals those of its transpose,
+ * where near vertical lines lie near horizontal.
+ */
+template <class Finder>
+std::vector<Line> findLines(const cv::Mat& edges, int houghThreshold, const DetectorOptions& detector, Finder finder) {
+	std::vector<Line> found;
+	finder(edges, houghThreshold, detector, 1.0, found);
+	if (detector.verticals) {
+		// transposing turns a line at 90 + a degrees into one at -a
+		cv::Mat transposed;
+		cv::transpose(edges, transposed);
+		finder(transposed, houghThreshold, detector, -1.0, found);
+	}
+	return found;
+}
+
+/**
+ * score every angle step by the squared votes of its lines, confidence judged
+ * on the lines with at least half the votes of the strongest.
+ */
+AngleEstimate scoreLines(const std::vector<Line>& lines, const DetectorOptions& detector) {
+	AngleEstimate estimate;
+	if (lines.empty()) {
+		return estimate;
+	}
+
+	int steps = angleSteps(detector);
+	std::vector<double> scores(steps, 0.0);
+	double strongest = 0.0;
+	for (const auto& line : lines) {
+		int step = std::clamp((int)std::lround((line.degrees + detector.maxSkew) / detector.angleResolution), 0, steps - 1);
+		scores[step] += line.votes * line.votes;
+		strongest = std::max(strongest, line.votes);
+	}
+	estimate.angle = stepAngle(peakStep(scores), detector);
+
+	// the strong lines only, a low threshold lets plenty of weak ones through at every angle
+	int agreeing = 0;
+	for (const auto& line : lines) {
+		if (line.votes >= strongest / 2) {
+			estimate.lines++;
+			if (std::abs(line.degrees - estimate.angle) <= 1.0) {
+				agreeing++;
+			}
+		}
+	}
+	estimate.confidence = (double)agreeing / estimate.lines;
+	return estimate;
+}
+
+} // namespace
+
+
+AngleEstimate restrictedEstimate(const cv::Mat& edges, int houghThreshold, const DetectorOptions& detector) {
+	return scoreLines(findLines(edges, houghThreshold, detector, houghLines), detector);
+}
+
+AngleEstimate bandedEstimate(const cv::Mat& edges, int houghThreshold, const DetectorOptions& detector) {
+	return scoreLines(findLines(edges, houghThreshold, detector, bandedLines), detector);
+}
+
+} // namespace rotimage
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "librotimage.h"
+
+/////////////////////////////////////////////////////////////////////////////////
+/// detectors that only look for lines within detector.maxSkew of horizontal,
+/// at detector.angleResolution steps instead of whole degrees. the smaller
+/// window pays for the finer steps.
+///
+/// both score every angle step by the squared votes of the lines found there,
+/// so long lines count for much more than short ones, and interpolate between
+/// steps with a parabola through the best one and its neighbours.
+///
+/// with detector.verticals the transposed edge map is searched as well, its
+/// lines mirrored back and scored with the rest.
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+/**
+ * cv::HoughLines limited to the window with min_theta / max_theta.
+ *
+ * @param edges Edge map.
+ * @param houghThreshold Votes a line needs.
+ * @param detector maxSkew and angleResolution.
+ * @return AngleEstimate The estimate, confidence judged on the lines with at least half the votes of the strongest.
+ */
+AngleEstimate restrictedEstimate(const cv::Mat& edges, int houghThreshold, const DetectorOptions& detector);
+
+/**
+ * the same vote, split into horizontal bands of the edge map that vote into
+ * their own accumulators in parallel and are summed at the end. a band's
+ * accumulator only covers the distances its rows can produce, so memory
+ * doesn't grow with the number of bands. for one huge image that needs its
+ * angle fast, cv::HoughLines only uses one core.
+ *
+ * @param edges Edge map.
+ * @param houghThreshold Votes a line needs.
+ * @param detector maxSkew and angleResolution.
+ * @return AngleEstimate The estimate, confidence judged on the lines with at least half the votes of the strongest.
+ */
+AngleEstimate bandedEstimate(const cv::Mat& edges, int houghThreshold, const DetectorOptions& detector);
+
+} // namespace rotimage
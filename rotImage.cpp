@@ -1,214 +1,86 @@
-#include <opencv2/opencv.hpp>
+#include "librotimage.h"
+#include "anglecache.h"
+#include "anglereport.h"
+#include "server.h"
+#include "stream.h"
+#include "watch.h"
 #include <argparse/argparse.hpp>
+#include <cstdio>
 #include <iostream>
 #include <filesystem>
-#include <vector>
+#include <sstream>
 #include <string>
-
-// used to determine if we need to calculate the angle later........
-static std::string referenceImagePath;
+#include <vector>
 
 /////////////////////////////////////////////////////////////////////////////////
 /// Quck app to rotate an image by an angle, optionally try to detect how far 
 /// off it is from level ( needs an image with close to horizonal lines to work)
+///
+/// command line wrapper only, the actual work is done by librotimage
 /////////////////////////////////////////////////////////////////////////////////
 
+// exit codes, scripts driving big batches want to tell a few bad images from a run that didn't happen
+enum {
+	ExitOk = 0,
+	ExitError = 1,    // bad arguments, or the job couldn't run / finish
+	ExitPartial = 2,  // the batch ran but some images failed
+};
 
 /**
- * check if a file is an image based on its extension
- *
- * @param path The file path.
- * @return bool True if the file is an image, false otherwise.
- */
-bool isImageFile(const std::filesystem::path& path) {
-	// @todo check what opencv actually supports..
-	const std::vector<std::string> imageExtensions = { ".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff" };
-	return std::find(imageExtensions.begin(), imageExtensions.end(), path.extension()) != imageExtensions.end();
-}
-
-
-/**
- * automatically try to determine the rotation angle of an image.
- *
- * @param src The source image.
- * @return double The estimated rotation angle in degrees.
- */
-double determineRotationAngle(const cv::Mat& src) {
-
-	// convert to grayscale
-	cv::Mat gray;
-	cv::cvtColor(src, gray, cv::COLOR_BGR2GRAY);
-	cv::GaussianBlur(gray, gray, cv::Size(5, 5), 0);
-
-	// edge detection
-	cv::Mat edges;
-	cv::Canny(gray, edges, 50, 150, 3);
-
-	// line detection
-	std::vector<cv::Vec4i> lines;
-	cv::HoughLinesP(edges, lines, 1, CV_PI / 180, 100, 50, 10);
-
-	// calculate the average angle of the lines
-	// not a great method
-	double angle = 0.0;
-	int count = 0;
-	for (const auto& line : lines) {
-		double theta = atan2(line[3] - line[1], line[2] - line[0]);
-		angle += theta;
-		count++;
-	}
-	if (count > 0) {
-		angle /= count; // average the angle
-	}
-
-	return angle * (180.0 / CV_PI);
-}
-
-
-/**
- * calculate the rotation angle from a reference image.
- *
- * @param referenceImagePath Path to the reference image.
- * @param successful Reference to a boolean flag indicating success or failure.
- * @param verbose Flag to enable verbose output.
- * @return double The calculated rotation angle.
+ * parse x,y,w,h for --detect-roi.
  */
-double calculateReferenceAngle(const std::string& referenceImagePath, bool& successful, bool verbose) {
-	cv::Mat referenceImage = cv::imread(referenceImagePath, cv::IMREAD_COLOR);
-	if (referenceImage.empty()) {
-		std::cerr << "Could not open or find the reference image: " << referenceImagePath << std::endl;
-		successful = false;
-		return 0.0;
+bool parseRegion(const std::string& text, cv::Rect2d& region) {
+	std::istringstream in(text);
+	double x, y, width, height;
+	char comma[3];
+	if (!(in >> x >> comma[0] >> y >> comma[1] >> width >> comma[2] >> height) || in.peek() != std::char_traits<char>::eof()) {
+		return false;
 	}
-
-	double angle = determineRotationAngle(referenceImage);
-	if (verbose) {
-		std::cout << "Rotation angle determined from reference image: " << angle << " degrees" << std::endl;
+	if (comma[0] != ',' || comma[1] != ',' || comma[2] != ',' || x < 0.0 || y < 0.0 || width <= 0.0 || height <= 0.0) {
+		return false;
 	}
-	successful = true;
-	return angle;
-}
-
-/**
- * rotate an image by a given angle
- *
- * @param src The source image to be rotated.
- * @param angle The angle in degrees to rotate the image.
- * @return cv::Mat The rotated image.
- */
-cv::Mat rotateImage(const cv::Mat& src, double angle) {
-	cv::Point2f center(src.cols / 2.0f, src.rows / 2.0f);
-	cv::Mat rot = cv::getRotationMatrix2D(center, angle, 1.0);
-	cv::Rect2f bbox = cv::RotatedRect(cv::Point2f(), src.size(), (float)angle).boundingRect2f();
-	rot.at<double>(0, 2) += bbox.width / 2.0 - src.cols / 2.0;
-	rot.at<double>(1, 2) += bbox.height / 2.0 - src.rows / 2.0;
-
-	cv::Mat dst;
-	cv::warpAffine(src, dst, rot, bbox.size());
-	return dst;
+	region = cv::Rect2d(x, y, width, height);
+	return true;
 }
 
-
 /**
- * process a single image file - rotate and save it, if the angle isn't 0.0
- *
- * @param inputFile The path of the input image file.
- * @param outputFile The path where the output image will be saved.
- * @param angle The angle to rotate the image.
- * @param verbose Flag to enable verbose output.
- * @return bool Status code (true for success, false for error).
+ * parse i/N for --shard.
  */
-bool processSingleImage(const std::string& inputFile, const std::string& outputFile, double angle, bool verbose) {
-
-	if (angle == 0.0) {
+bool parseShard(const std::string& text, unsigned& index, unsigned& count) {
+	// >> would wrap a negative number around into a huge unsigned one
+	if (text.find('-') != std::string::npos) {
 		return false;
 	}
-	cv::Mat image = cv::imread(inputFile, cv::IMREAD_COLOR);
-	if (image.empty()) {
-		std::cerr << "Could not open or find the image: " << inputFile << std::endl;
+	std::istringstream in(text);
+	char slash;
+	if (!(in >> index >> slash >> count) || slash != '/' || in.peek() != std::char_traits<char>::eof()) {
 		return false;
 	}
-	cv::Mat rotatedImage = rotateImage(image, angle);
-	if (rotatedImage.empty()) {
-		std::cerr << "Error rotating the image." << std::endl;
-		return false;
-	}
-
-	if (!cv::imwrite(outputFile, rotatedImage)) {
-		std::cerr << "Failed to write the image to: " << outputFile << std::endl;
-		return false;
-	}
-
-	if (verbose) {
-		std::cout << "Image rotated successfully and saved to " << outputFile << std::endl;
-	}
-	return true;
+	return index < count;
 }
 
-/**
- * process all images in a directory. recursively as an option.
- *
- * @param inputDir The input directory path.
- * @param outputDir The output directory path.
- * @param angle The angle to rotate the images.
- * @param recursive Flag to enable recursive processing of subdirectories.
- * @param verbose Flag to enable verbose output.
- * @return bool Status code (true for success, false for error).
- */
-bool processDirectory(const std::string& inputDir, const std::string& outputDir, double angle, bool recursive, bool verbose) {
-	std::filesystem::directory_iterator iter(inputDir), end;
-	std::error_code ec;
-
-	while (iter != end) {
-		const auto& entry = *iter;
-		if (isImageFile(entry.path())) {
-			std::string outputFilePath = (std::filesystem::path(outputDir) / entry.path().filename()).string();
-
-
-			if (referenceImagePath.empty()) {
-				bool successful;
-
-				double t_angle = calculateReferenceAngle(entry.path().string(), successful, verbose);
-				if (successful) {
-					angle = t_angle;
-				}
-
-
-			}
-
-			if (!processSingleImage(entry.path().string(), outputFilePath, angle, verbose) ) {
-				std::cerr << "Failed to process image: " << entry.path() << std::endl;
-				return false;
-
-			}
-			else if (verbose) {
-				std::cout << "Processed " << entry.path() << std::endl;
-			}
-		}
-		if (recursive && entry.is_directory()) {
-			processDirectory(entry.path().string(), outputDir, angle, true, verbose);
-		}
-
-		iter.increment(ec);
-		if (ec && verbose) {
-			std::cerr << "Warning: Error accessing " << iter->path() << ": " << ec.message() << std::endl;
-
-		}
+int runDirectory(const std::string& inputPath, const std::string& outputPath, const rotimage::Options& options) {
+	rotimage::BatchSummary summary;
+	if (rotimage::processDirectory(inputPath, outputPath, options, &summary)) {
+		return ExitOk;
 	}
-	return true;
+	return summary.complete ? ExitPartial : ExitError;
 }
 
 
 int main(int argc, char** argv) {
 	argparse::ArgumentParser program("rotImage");
 
+	// required unless running as a daemon, checked after parsing
 	program.add_argument("-i", "--input")
-		.help("Specify the input image file path or input directory path.")
-		.required();
+		.help("Specify the input image file path or input directory path, - for stdin.");
 
 	program.add_argument("-o", "--output")
-		.help("Specify the output image file path or output directory path.")
-		.required();
+		.help("Specify the output image file path or output directory path, - for stdout.");
+
+	program.add_argument("-f", "--format")
+		.help("Encoding used when writing to stdout, e.g. .png. Defaults to the input extension.")
+		.default_value(std::string());
 
 	program.add_argument("-a", "--angle")
 		.help("Specify the rotation angle in degrees.")
@@ -220,6 +92,26 @@ int main(int argc, char** argv) {
 		.implicit_value(true)
 		.help("Recursively process all image files in subdirectories.");
 
+	program.add_argument("--metadata-rotate")
+		.default_value(false)
+		.implicit_value(true)
+		.help("Turn jpegs and tiffs by whole quarter turns ( -a 90, 180, 270 or --angles-from ) by changing only their exif orientation, without decoding them.");
+
+	program.add_argument("--strip-metadata")
+		.default_value(false)
+		.implicit_value(true)
+		.help("Don't carry exif, colour profiles and other metadata over from jpeg inputs to jpeg outputs.");
+
+	program.add_argument("--unchanged")
+		.default_value(false)
+		.implicit_value(true)
+		.help("Keep 16 bit, float, grayscale and alpha images as they are instead of converting them to 8 bit colour. Transparent images get transparent corners.");
+
+	program.add_argument("--mirror")
+		.default_value(false)
+		.implicit_value(true)
+		.help("Recreate the input subdirectories under the output directory instead of writing every image straight into it.");
+
 	program.add_argument("-v", "--verbose")
 		.default_value(false)
 		.implicit_value(true)
@@ -230,63 +122,307 @@ int main(int argc, char** argv) {
 		.implicit_value(true)
 		.help("Automatically detect and correct the rotation angle of the image.");
 
+	program.add_argument("--detect-roi")
+		.help("Only look for lines in this region, x,y,w,h in pixels or as fractions of the image size, e.g. 0.1,0.2,0.8,0.5.");
+
+	program.add_argument("--detect-center")
+		.help("Only look for lines in the central part of the image, this fraction of its width and height, e.g. 0.6.")
+		.scan<'g', double>();
+
+	program.add_argument("--adaptive-canny")
+		.default_value(false)
+		.implicit_value(true)
+		.help("Pick the edge thresholds per image instead of the fixed 50 / 150, for faint scans and busy photos.");
+
+	program.add_argument("--max-edge-pixels")
+		.help("Thin the edges out to at most this many pixels before looking for lines, bounds the detection time per image.")
+		.scan<'i', int>();
+
+	program.add_argument("--max-skew")
+		.help("Only look for lines within this many degrees of horizontal, at --angle-resolution steps. Faster and more precise when the skew is known to be small.")
+		.scan<'g', double>();
+
+	program.add_argument("--angle-resolution")
+		.help("Step in degrees used with --max-skew.")
+		.scan<'g', double>()
+		.default_value(0.05);
+
+	program.add_argument("--parallel-hough")
+		.default_value(false)
+		.implicit_value(true)
+		.help("With --max-skew, vote for lines on every core instead of one. For single large images, batches are already spread over the cores.");
+
+	program.add_argument("--verticals")
+		.default_value(false)
+		.implicit_value(true)
+		.help("Count near vertical lines as well, for buildings, tables and text columns. Angles are then between -45 and 45 degrees.");
+
+	program.add_argument("--orientation")
+		.default_value(false)
+		.implicit_value(true)
+		.help("Also turn scanned pages that are on their side or upside down, told from their text lines. Implies --verticals and --refine.");
+
+	program.add_argument("--refine")
+		.help("Search this many degrees either side of the detected angle for a more precise one, e.g. 1.")
+		.scan<'g', double>();
+
 	program.add_argument("-ref", "--reference")
 		.help("Specify the path to a reference image. The rotation angle of this image will be used for all other images.");
 
+	program.add_argument("-w", "--watch")
+		.default_value(false)
+		.implicit_value(true)
+		.help("Process the input directory, then keep watching it and process new files as they arrive.");
+
+	program.add_argument("-m", "--manifest")
+		.help("Incremental mode, skip images that haven't changed since the run recorded in this file.");
+
+	program.add_argument("--detect-only")
+		.help("Only detect, write the angle and confidence of every image in the input directory to this .csv or .json report.");
+
+	program.add_argument("--angles-from")
+		.help("Rotate the images in the input directory by the angles in this --detect-only report instead of detecting them.");
+
+	program.add_argument("--angle-cache")
+		.help("Keep detected angles in this file, keyed by image content and detector settings, and reuse them on later runs.");
+
+	program.add_argument("--fail-fast")
+		.default_value(false)
+		.implicit_value(true)
+		.help("Stop a directory run at the first image that fails, instead of carrying on with the rest.");
+
+	program.add_argument("--retries")
+		.help("Extra attempts for images that failed to read or write, e.g. on a flaky network mount.")
+		.scan<'i', int>()
+		.default_value(2);
+
+	program.add_argument("--failures")
+		.help("Write the path of every image that failed, with the reason, to this file.");
+
+	program.add_argument("--journal")
+		.help("Checkpoint every finished image of a directory run to this file, see --resume.");
+
+	program.add_argument("--resume")
+		.default_value(false)
+		.implicit_value(true)
+		.help("Carry on with a killed directory run, skipping the images already in its --journal.");
+
+	program.add_argument("--shard")
+		.help("Only process part i/N of the input directory ( 0 <= i < N ), so N machines sharing the tree can split it between them.");
+
+	program.add_argument("--merge-reports")
+		.help("Merge the --detect-only reports written by the shards of a --shard run into the report given with --output.")
+		.nargs(argparse::nargs_pattern::at_least_one);
+
+	program.add_argument("-j", "--threads")
+		.help("Number of worker threads, 0 for one per core.")
+		.scan<'i', int>()
+		.default_value(0);
+
+	program.add_argument("--serve")
+		.help("Run as a daemon, taking rotate/detect jobs over a unix socket at this path.");
+
+	program.add_argument("--stream")
+		.default_value(false)
+		.implicit_value(true)
+		.help("Take framed rotate/detect jobs on stdin and write the results to stdout, same protocol as --serve.");
+
 	try {
 		program.parse_args(argc, argv);
 	}
 	catch (const std::runtime_error& err) {
 		std::cerr << "Error parsing arguments: " << err.what() << std::endl;
 		std::cerr << program;
-		return 1;
+		return ExitError;
+	}
+
+	rotimage::Options options;
+	options.angle = program.get<double>("angle");
+	options.recursive = program["--recursive"] == true;
+	options.mirror = program["--mirror"] == true;
+	options.stripMetadata = program["--strip-metadata"] == true;
+	options.metadataRotate = program["--metadata-rotate"] == true;
+	options.unchanged = program["--unchanged"] == true;
+	options.verbose = program["--verbose"] == true;
+	options.failFast = program["--fail-fast"] == true;
+	options.retries = (unsigned)std::max(0, program.get<int>("--retries"));
+	if (program.is_used("--failures")) {
+		options.failureList = program.get<std::string>("--failures");
+	}
+	if (program.is_used("--journal")) {
+		options.journal = program.get<std::string>("--journal");
+	}
+	options.resume = program["--resume"] == true;
+	if (options.resume && options.journal.empty()) {
+		std::cerr << "--resume needs the --journal of the run to resume" << std::endl;
+		return ExitError;
+	}
+	options.threads = (size_t)std::max(0, program.get<int>("--threads"));
+	if (program.is_used("--manifest")) {
+		options.manifest = program.get<std::string>("--manifest");
+	}
+	if (program.is_used("--detect-roi") && program.is_used("--detect-center")) {
+		std::cerr << "--detect-roi and --detect-center can't be used together" << std::endl;
+		return ExitError;
+	}
+	if (program.is_used("--detect-roi") && !parseRegion(program.get<std::string>("--detect-roi"), options.detector.roi)) {
+		std::cerr << "--detect-roi must be x,y,w,h with a positive width and height, not " << program.get<std::string>("--detect-roi") << std::endl;
+		return ExitError;
+	}
+	if (program.is_used("--detect-center")) {
+		double fraction = program.get<double>("--detect-center");
+		if (fraction <= 0.0 || fraction > 1.0) {
+			std::cerr << "--detect-center must be more than 0 and at most 1" << std::endl;
+			return ExitError;
+		}
+		double margin = (1.0 - fraction) / 2.0;
+		options.detector.roi = cv::Rect2d(margin, margin, fraction, fraction);
+	}
+	if (program["--adaptive-canny"] == true) {
+		// the strongest 10% of gradients may start an edge
+		options.detector.adaptiveEdgeFraction = 0.1;
+	}
+	if (program.is_used("--max-edge-pixels")) {
+		options.detector.maxEdgePixels = std::max(0, program.get<int>("--max-edge-pixels"));
+	}
+	if (program.is_used("--max-skew")) {
+		options.detector.maxSkew = program.get<double>("--max-skew");
+		options.detector.angleResolution = program.get<double>("--angle-resolution");
+		if (options.detector.maxSkew <= 0.0 || options.detector.maxSkew >= 90.0 || options.detector.angleResolution <= 0.0) {
+			std::cerr << "--max-skew must be between 0 and 90 degrees, with a positive --angle-resolution" << std::endl;
+			return ExitError;
+		}
+	}
+	if (program.get<bool>("--parallel-hough")) {
+		if (options.detector.maxSkew <= 0.0) {
+			std::cerr << "--parallel-hough needs --max-skew" << std::endl;
+			return ExitError;
+		}
+		options.detector.parallelVoting = true;
+	}
+	options.detector.verticals = program.get<bool>("--verticals");
+	options.detector.orientation = program.get<bool>("--orientation");
+	if (program.is_used("--refine")) {
+		options.detector.refineWindow = program.get<double>("--refine");
+		if (options.detector.refineWindow <= 0.0 || options.detector.refineWindow > 45.0) {
+			std::cerr << "--refine must be between 0 and 45 degrees" << std::endl;
+			return ExitError;
+		}
+	}
+	if (program.is_used("--angle-cache")) {
+		options.angleCache = std::make_shared<rotimage::AngleCache>();
+		if (!options.angleCache->open(program.get<std::string>("--angle-cache"))) {
+			std::cerr << "Failed to open the angle cache: " << program.get<std::string>("--angle-cache") << std::endl;
+			return ExitError;
+		}
+	}
+
+	if (program.is_used("--serve")) {
+		return rotimage::serve(program.get<std::string>("--serve"), options);
+	}
+
+	if (program["--stream"] == true) {
+		// stdout carries image data, keep verbose chatter off it
+		std::cout.rdbuf(std::cerr.rdbuf());
+		return rotimage::serveStream(stdin, stdout, options);
+	}
+
+	if (program.is_used("--merge-reports")) {
+		if (!program.is_used("--output")) {
+			std::cerr << "--merge-reports needs --output for the merged report" << std::endl;
+			return ExitError;
+		}
+		auto reports = program.get<std::vector<std::string>>("--merge-reports");
+		return rotimage::mergeAngleReports(reports, program.get<std::string>("--output")) ? ExitOk : ExitError;
+	}
+
+	if (program.is_used("--shard")) {
+		std::string shard = program.get<std::string>("--shard");
+		unsigned index, count;
+		if (!parseShard(shard, index, count)) {
+			std::cerr << "--shard must be i/N with 0 <= i < N, not " << shard << std::endl;
+			return ExitError;
+		}
+		options.shard = index;
+		options.shardCount = count;
+	}
+
+	if (program.is_used("--detect-only")) {
+		options.detectOnly = program.get<std::string>("--detect-only");
+	}
+	if (program.is_used("--angles-from")) {
+		options.anglesFrom = program.get<std::string>("--angles-from");
+	}
+
+	if (!program.is_used("--input") || (!program.is_used("--output") && options.detectOnly.empty())) {
+		std::cerr << "Error parsing arguments: --input and --output are required" << std::endl;
+		std::cerr << program;
+		return ExitError;
 	}
 
 	std::string inputPath = program.get<std::string>("input");
-	std::string outputPath = program.get<std::string>("output");
-	double angle = program.get<double>("angle");
-	bool recursive = program["--recursive"] == true;
-	bool verbose = program["--verbose"] == true;
-	
+	std::string outputPath = program.is_used("--output") ? program.get<std::string>("output") : std::string();
+	std::string referenceImagePath;
+
+	if (outputPath == "-") {
+		std::cout.rdbuf(std::cerr.rdbuf());
+	}
+
 	if (program.is_used("--reference")) {
 		referenceImagePath = program.get<std::string>("--reference");
 	}
-	else {
-		referenceImagePath = "";
-	}
 
 	// use the reference image to calculate the angle to rotate by
 	if (!referenceImagePath.empty()) {
 		bool successful;
 
-		double t_angle = calculateReferenceAngle(referenceImagePath, successful, verbose);
+		double t_angle = rotimage::calculateReferenceAngle(referenceImagePath, successful, options);
 		if (successful) {
-			angle = t_angle;
+			options.angle = t_angle;
 		}
 	}
 
 	if (std::filesystem::is_directory(inputPath)) {
+		if (!options.detectOnly.empty()) {
+			options.detect = true;
+			return runDirectory(inputPath, outputPath, options);
+		}
+
 		if (!std::filesystem::exists(outputPath)) {
 			if (!std::filesystem::create_directories(outputPath)) {
 				std::cerr << "Failed to create output directory: " << outputPath << std::endl;
-				return 1;
+				return ExitError;
 			}
 		}
-		return processDirectory(inputPath, outputPath, angle, recursive, verbose);
+		// without a reference image or a fixed angle every file gets its own angle
+		options.detect = referenceImagePath.empty() && !program.is_used("--angle");
+		if (program["--watch"] == true) {
+			return rotimage::watchDirectory(inputPath, outputPath, options);
+		}
+		return runDirectory(inputPath, outputPath, options);
 	}
 	else {
+		if (!options.detectOnly.empty() || !options.anglesFrom.empty() || options.shardCount > 1) {
+			std::cerr << "--detect-only, --angles-from and --shard need an input directory" << std::endl;
+			return ExitError;
+		}
 
 		// if no reference image, then try to calculate the angle to rotate by, this is only going to work on 
 		// very specific images.
 		// we're not calculating angle, so a 0.0 is ok
-		if (( angle == 0.0 ) && referenceImagePath.empty()) {
+		if (( options.angle == 0.0 ) && referenceImagePath.empty()) {
+			options.detect = true;
+		}
 
-			bool successful;
-			angle = calculateReferenceAngle(inputPath, successful, verbose);
-			if (!successful) return 1;
+		if (inputPath == "-" || outputPath == "-") {
+			return rotimage::processPipe(inputPath, outputPath, program.get<std::string>("--format"), options) ? ExitOk : ExitError;
+		}
 
+		if (options.detect) {
+			rotimage::Deskewer deskewer(options);
+			return deskewer.processFile(inputPath, outputPath) ? ExitOk : ExitError;
 		}
 
-		return processSingleImage(inputPath, outputPath, angle, verbose);
+		return rotimage::processSingleImage(inputPath, outputPath, options) ? ExitOk : ExitError;
 	}
 }
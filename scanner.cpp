@@ -0,0 +1,185 @@
+#include "scanner.h"
+
+#include <iostream>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace rotimage {
+
+namespace {
+
+std::filesystem::path absoluteNormal(const std::filesystem::path& path) {
+	std::error_code ec;
+	auto absolute = std::filesystem::absolute(path, ec);
+	auto normal = (ec ? path : absolute).lexically_normal();
+	// "out/" keeps an empty last element, it would never equal the "out" of a listing
+	if (normal.has_relative_path() && normal.filename().empty()) {
+		normal = normal.parent_path();
+	}
+	return normal;
+}
+
+} // namespace
+
+#ifdef __linux__
+
+namespace {
+
+// layout the kernel fills in, glibc doesn't export it
+struct LinuxDirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+
+enum class EntryType { File, Directory, Other };
+
+EntryType classify(int dirFd, const LinuxDirent64* entry) {
+	switch (entry->d_type) {
+	case DT_REG:
+		return EntryType::File;
+	case DT_DIR:
+		return EntryType::Directory;
+	case DT_LNK:
+	case DT_UNKNOWN: {
+		// some filesystems don't fill in d_type, and symlinks need resolving
+		struct stat info;
+		int flags = entry->d_type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW;
+		if (fstatat(dirFd, entry->d_name, &info, flags) != 0) {
+			return EntryType::Other;
+		}
+		if (S_ISREG(info.st_mode)) {
+			return EntryType::File;
+		}
+		// never follow a link into a directory, it could loop
+		return S_ISDIR(info.st_mode) && entry->d_type != DT_LNK ? EntryType::Directory : EntryType::Other;
+	}
+	default:
+		return EntryType::Other;
+	}
+}
+
+} // namespace
+
+
+bool scanDirectory(const std::filesystem::path& root, bool recursive, const std::filesystem::path& skip,
+	const std::function<bool(const std::filesystem::path&)>& onFile) {
+
+	std::filesystem::path skipNormal = skip.empty() ? skip : absoluteNormal(skip);
+	std::vector<char> buffer(256 * 1024);
+	std::vector<std::filesystem::path> pending = { root };
+	bool first = true;
+
+	while (!pending.empty()) {
+		std::filesystem::path dir = std::move(pending.back());
+		pending.pop_back();
+
+		int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0) {
+			std::cerr << "Warning: Error accessing " << dir << ": " << strerror(errno) << std::endl;
+			if (first) {
+				return false;
+			}
+			continue;
+		}
+		first = false;
+
+		for (;;) {
+			long length = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+			if (length < 0) {
+				std::cerr << "Warning: Error reading " << dir << ": " << strerror(errno) << std::endl;
+				break;
+			}
+			if (length == 0) {
+				break;
+			}
+
+			for (long pos = 0; pos < length; ) {
+				const LinuxDirent64* entry = (const LinuxDirent64*)(buffer.data() + pos);
+				pos += entry->d_reclen;
+
+				const char* name = entry->d_name;
+				if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+					continue;
+				}
+
+				EntryType type = classify(fd, entry);
+				if (type == EntryType::File) {
+					if (!onFile(dir / name)) {
+						close(fd);
+						return false;
+					}
+				}
+				else if (type == EntryType::Directory && recursive) {
+					std::filesystem::path child = dir / name;
+					if (skipNormal.empty() || absoluteNormal(child) != skipNormal) {
+						pending.push_back(std::move(child));
+					}
+				}
+			}
+		}
+		close(fd);
+	}
+	return true;
+}
+
+#else
+
+bool scanDirectory(const std::filesystem::path& root, bool recursive, const std::filesystem::path& skip,
+	const std::function<bool(const std::filesystem::path&)>& onFile) {
+
+	std::filesystem::path skipNormal = skip.empty() ? skip : absoluteNormal(skip);
+	std::vector<std::filesystem::path> pending = { root };
+	bool first = true;
+
+	while (!pending.empty()) {
+		std::filesystem::path dir = std::move(pending.back());
+		pending.pop_back();
+
+		std::error_code ec;
+		std::filesystem::directory_iterator iter(dir, ec), end;
+		if (ec) {
+			std::cerr << "Warning: Error accessing " << dir << ": " << ec.message() << std::endl;
+			if (first) {
+				return false;
+			}
+			continue;
+		}
+		first = false;
+
+		// the entry caches what the directory listing returned, none of these stat
+		for (; iter != end; iter.increment(ec)) {
+			const auto& entry = *iter;
+			std::error_code typeEc;
+			if (entry.is_regular_file(typeEc)) {
+				if (!onFile(entry.path())) {
+					return false;
+				}
+			}
+			else if (recursive && entry.is_directory(typeEc) && !entry.is_symlink(typeEc)) {
+				if (skipNormal.empty() || absoluteNormal(entry.path()) != skipNormal) {
+					pending.push_back(entry.path());
+				}
+			}
+		}
+		if (ec) {
+			std::cerr << "Warning: Error reading " << dir << ": " << ec.message() << std::endl;
+		}
+	}
+	return true;
+}
+
+#endif
+
+} // namespace rotimage
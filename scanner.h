@@ -0,0 +1,30 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// directory traversal, hands out files as they are found so processing can
+/// start while the rest of the tree is still being enumerated.
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+/**
+ * enumerate a directory tree. on linux entries are read in bulk with getdents64
+ * and classified by d_type, so regular files cost no stat at all. elsewhere the
+ * attributes cached by std::filesystem::directory_entry are used.
+ *
+ * symlinks to files are reported, symlinks to directories aren't followed.
+ * directories that can't be read are reported on stderr and skipped.
+ *
+ * @param root The directory to scan.
+ * @param recursive Descend into subdirectories.
+ * @param skip A directory to leave out ( e.g. an output directory inside the tree ), may be empty.
+ * @param onFile Called for every file found, return false to stop the scan.
+ * @return bool False if root couldn't be read or onFile stopped the scan.
+ */
+bool scanDirectory(const std::filesystem::path& root, bool recursive, const std::filesystem::path& skip,
+	const std::function<bool(const std::filesystem::path&)>& onFile);
+
+} // namespace rotimage
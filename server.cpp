@@ -0,0 +1,424 @@
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <csignal>
+#endif
+
+#include "server.h"
+#include "hashing.h"
+#include "stream.h"
+#include "workerpool.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace rotimage {
+
+namespace {
+
+#ifdef _WIN32
+typedef SOCKET socket_t;
+#define closeSocket closesocket
+#else
+typedef int socket_t;
+const socket_t INVALID_SOCKET = -1;
+#define closeSocket close
+#endif
+
+// refuse anything bigger, a broken client shouldn't be able to make us allocate gigabytes
+const uint32_t maxFrameSize = 256u * 1024u * 1024u;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Message {
+	std::string command;
+	std::map<std::string, std::string> fields;
+	std::vector<uchar> data;
+};
+
+/**
+ * somewhere frames come from and go to, a socket for the daemon or
+ * stdin / stdout for stream mode.
+ */
+class Channel {
+public:
+	virtual ~Channel() {}
+	virtual bool read(char* buffer, size_t length) = 0;
+	virtual bool write(const char* buffer, size_t length) = 0;
+	virtual bool flush() { return true; }
+};
+
+class SocketChannel : public Channel {
+public:
+	explicit SocketChannel(socket_t socket) : socket(socket) {}
+
+	bool read(char* buffer, size_t length) override {
+		while (length > 0) {
+			auto received = recv(socket, buffer, (int)std::min<size_t>(length, 1 << 30), 0);
+			if (received <= 0) {
+				return false;
+			}
+			buffer += received;
+			length -= (size_t)received;
+		}
+		return true;
+	}
+
+	bool write(const char* buffer, size_t length) override {
+		while (length > 0) {
+			auto sent = send(socket, buffer, (int)std::min<size_t>(length, 1 << 30), 0);
+			if (sent <= 0) {
+				return false;
+			}
+			buffer += sent;
+			length -= (size_t)sent;
+		}
+		return true;
+	}
+
+private:
+	socket_t socket;
+};
+
+class FileChannel : public Channel {
+public:
+	FileChannel(std::FILE* in, std::FILE* out) : in(in), out(out) {}
+
+	bool read(char* buffer, size_t length) override {
+		return std::fread(buffer, 1, length, in) == length;
+	}
+
+	bool write(const char* buffer, size_t length) override {
+		return std::fwrite(buffer, 1, length, out) == length;
+	}
+
+	bool flush() override {
+		return std::fflush(out) == 0;
+	}
+
+private:
+	std::FILE* in;
+	std::FILE* out;
+};
+
+/**
+ * read one length prefixed frame.
+ *
+ * @param channel Where to read from.
+ * @param frame Receives the payload.
+ * @return bool False on EOF, error or an oversized frame.
+ */
+bool readFrame(Channel& channel, std::vector<char>& frame) {
+	unsigned char prefix[4];
+	if (!channel.read((char*)prefix, sizeof(prefix))) {
+		return false;
+	}
+	uint32_t length = prefix[0] | (prefix[1] << 8) | (prefix[2] << 16) | ((uint32_t)prefix[3] << 24);
+	if (length > maxFrameSize) {
+		std::cerr << "Rejecting oversized frame of " << length << " bytes" << std::endl;
+		return false;
+	}
+	frame.resize(length);
+	return channel.read(frame.data(), length);
+}
+
+bool writeFrame(Channel& channel, const Message& message) {
+	std::string text = message.command + "\n";
+	for (const auto& field : message.fields) {
+		text += field.first + "=" + field.second + "\n";
+	}
+	text += "\n";
+
+	uint32_t length = (uint32_t)(text.size() + message.data.size());
+	unsigned char prefix[4] = { (unsigned char)length, (unsigned char)(length >> 8), (unsigned char)(length >> 16), (unsigned char)(length >> 24) };
+
+	return channel.write((const char*)prefix, sizeof(prefix)) &&
+		channel.write(text.data(), text.size()) &&
+		channel.write((const char*)message.data.data(), message.data.size()) &&
+		channel.flush();
+}
+
+Message parseMessage(const std::vector<char>& frame) {
+	Message message;
+	size_t pos = 0;
+	bool first = true;
+
+	while (pos < frame.size()) {
+		const char* start = frame.data() + pos;
+		const char* newline = (const char*)memchr(start, '\n', frame.size() - pos);
+		if (!newline) {
+			break;
+		}
+		std::string line(start, newline);
+		pos += line.size() + 1;
+
+		// blank line, the rest is image data
+		if (line.empty()) {
+			break;
+		}
+		if (first) {
+			message.command = line;
+			first = false;
+			continue;
+		}
+		size_t equals = line.find('=');
+		if (equals != std::string::npos) {
+			message.fields[line.substr(0, equals)] = line.substr(equals + 1);
+		}
+	}
+	message.data.assign(frame.begin() + pos, frame.end());
+	return message;
+}
+
+std::string formatNumber(double value) {
+	std::ostringstream out;
+	out.precision(10);
+	out << value;
+	return out.str();
+}
+
+/**
+ * milliseconds since mark, and move mark to now.
+ */
+std::string lap(Clock::time_point& mark) {
+	auto now = Clock::now();
+	double ms = std::chrono::duration<double, std::milli>(now - mark).count();
+	mark = now;
+	return formatNumber(ms);
+}
+
+Message runJob(const Message& request, const Options& defaults) {
+	Message response;
+	response.command = "ok";
+
+	auto fail = [&response](const std::string& message) {
+		response.command = "error";
+		response.fields["message"] = message;
+		response.data.clear();
+		return response;
+	};
+
+	if (request.command != "detect" && request.command != "rotate") {
+		return fail("unknown command: " + request.command);
+	}
+
+	auto start = Clock::now();
+	auto mark = start;
+
+	try {
+		auto path = request.fields.find("path");
+		// the encoded input, kept for the angle cache and the metadata of the output
+		std::vector<uchar> fileBytes;
+		const std::vector<uchar>* encoded = &request.data;
+		if (path != request.fields.end()) {
+			readFileBytes(path->second, fileBytes);
+			encoded = &fileBytes;
+		}
+		else if (request.data.empty()) {
+			return fail("no path or image data");
+		}
+		cv::Mat image;
+		if (!encoded->empty()) {
+			image = decodeImage(*encoded, decodeFlags(defaults));
+		}
+		uint64_t contentHash = 0;
+		if (defaults.angleCache) {
+			contentHash = hashBytes(encoded->data(), encoded->size());
+		}
+		if (image.empty()) {
+			return fail("could not open or decode the image");
+		}
+		response.fields["decode_ms"] = lap(mark);
+
+		Deskewer deskewer(defaults);
+
+		double angle;
+		auto angleField = request.fields.find("angle");
+		if (request.command == "detect" || angleField == request.fields.end()) {
+			angle = defaults.angleCache ? deskewer.estimate(image, contentHash) : deskewer.estimate(image);
+			response.fields["detect_ms"] = lap(mark);
+		}
+		else {
+			angle = std::stod(angleField->second);
+		}
+		response.fields["angle"] = formatNumber(angle);
+
+		if (request.command == "rotate") {
+			cv::Mat rotatedImage = deskewer.rotate(image, angle);
+			response.fields["rotate_ms"] = lap(mark);
+			const std::vector<uchar>* original = defaults.stripMetadata ? nullptr : encoded;
+
+			if (path != request.fields.end()) {
+				auto out = request.fields.find("out");
+				if (out == request.fields.end()) {
+					return fail("rotate with path= needs out=");
+				}
+				std::vector<uchar> result;
+				if (!encodeImage(std::filesystem::path(out->second).extension().string(), rotatedImage, result, original)) {
+					return fail("failed to encode the image for: " + out->second);
+				}
+				if (!writeFileBytes(out->second, result)) {
+					return fail("failed to write the image to: " + out->second);
+				}
+			}
+			else {
+				auto format = request.fields.find("format");
+				std::string extension = format != request.fields.end() ? format->second : ".png";
+				if (!encodeImage(extension, rotatedImage, response.data, original)) {
+					return fail("failed to encode the image as " + extension);
+				}
+			}
+			response.fields["encode_ms"] = lap(mark);
+		}
+	}
+	catch (const std::exception& e) {
+		return fail(e.what());
+	}
+
+	response.fields["total_ms"] = formatNumber(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+	return response;
+}
+
+void logJob(const Message& request, const Message& response, const Options& defaults) {
+	if (!defaults.verbose) {
+		return;
+	}
+	auto total = response.fields.find("total_ms");
+	std::cout << request.command << " " << response.command;
+	if (total != response.fields.end()) {
+		std::cout << " " << total->second << " ms";
+	}
+	std::cout << std::endl;
+}
+
+/**
+ * read requests off one connection until the client hangs up. the actual work
+ * goes to the shared pool, so the number of connections doesn't change how
+ * many images are processed at once.
+ */
+void handleConnection(socket_t client, std::shared_ptr<WorkerPool> pool, Options defaults) {
+	SocketChannel channel(client);
+	std::vector<char> frame;
+	while (readFrame(channel, frame)) {
+		Message request = parseMessage(frame);
+		Message response = pool->submit([&request, &defaults] { return runJob(request, defaults); }).get();
+
+		logJob(request, response, defaults);
+		if (!writeFrame(channel, response)) {
+			break;
+		}
+	}
+	closeSocket(client);
+}
+
+} // namespace
+
+
+int serve(const std::string& socketPath, const Options& defaults) {
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+		std::cerr << "Failed to initialise winsock" << std::endl;
+		return 1;
+	}
+#else
+	// a client going away mid response shouldn't kill the daemon
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path)) {
+		std::cerr << "Socket path too long: " << socketPath << std::endl;
+		return 1;
+	}
+	memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+	// a stale socket from a previous run would make bind fail
+	std::error_code ec;
+	std::filesystem::remove(socketPath, ec);
+
+	socket_t listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == INVALID_SOCKET) {
+		std::cerr << "Failed to create socket" << std::endl;
+		return 1;
+	}
+	if (bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+		std::cerr << "Failed to listen on: " << socketPath << std::endl;
+		closeSocket(listener);
+		return 1;
+	}
+
+	// shared so connection threads can't outlive it
+	auto pool = std::make_shared<WorkerPool>(defaults.threads);
+	if (defaults.verbose) {
+		std::cout << "Listening on " << socketPath << " with " << pool->size() << " workers" << std::endl;
+	}
+
+	for (;;) {
+		socket_t client = accept(listener, nullptr, nullptr);
+		if (client == INVALID_SOCKET) {
+			std::cerr << "Failed to accept connection" << std::endl;
+			continue;
+		}
+		std::thread(handleConnection, client, pool, defaults).detach();
+	}
+}
+
+
+int serveStream(std::FILE* in, std::FILE* out, const Options& defaults) {
+	setBinaryMode(in);
+	setBinaryMode(out);
+
+	FileChannel channel(in, out);
+	WorkerPool pool(defaults.threads);
+
+	// keep a few jobs per worker in flight, responses still go out in request order
+	const size_t window = pool.size() * 2;
+	std::deque<std::pair<std::string, std::future<Message>>> pending;
+
+	auto finishOldest = [&]() {
+		Message request;
+		request.command = pending.front().first;
+		Message response = pending.front().second.get();
+		pending.pop_front();
+		logJob(request, response, defaults);
+		return writeFrame(channel, response);
+	};
+
+	std::vector<char> frame;
+	while (readFrame(channel, frame)) {
+		auto request = std::make_shared<Message>(parseMessage(frame));
+		pending.emplace_back(request->command, pool.submit([request, &defaults] { return runJob(*request, defaults); }));
+
+		if (pending.size() >= window && !finishOldest()) {
+			std::cerr << "Failed to write to the output stream" << std::endl;
+			return 1;
+		}
+	}
+	while (!pending.empty()) {
+		if (!finishOldest()) {
+			std::cerr << "Failed to write to the output stream" << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+} // namespace rotimage
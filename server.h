@@ -0,0 +1,51 @@
+#pragma once
+
+#include "librotimage.h"
+#include <cstdio>
+#include <string>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// daemon mode, keeps a warm worker pool and takes jobs over a local socket
+/// ( or stdin / stdout ) so callers don't pay process start and opencv init
+/// for every image.
+///
+/// every message in either direction is a 4 byte little endian length followed
+/// by that many bytes. the message starts with text lines, the first line is
+/// the command or status, the rest are key=value pairs. a blank line ends the
+/// text, anything after it is raw image data.
+///
+/// requests
+///   detect        path=<file>, or the encoded image as data
+///   rotate        path=<file> out=<file>, or the encoded image as data
+///                 angle=<degrees> optional, detected when missing
+///                 format=<.ext> encoding of returned data, default .png
+///
+/// responses
+///   ok / error    angle= decode_ms= detect_ms= rotate_ms= encode_ms= total_ms=
+///                 message= on error, rotated image as data for in-memory rotates
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+/**
+ * listen on a unix domain socket and serve jobs until the process is stopped.
+ *
+ * @param socketPath Path of the socket to create, an existing file is replaced.
+ * @param defaults Detector tuning, verbosity and worker count used for every job.
+ * @return int Exit code, 0 on clean shutdown.
+ */
+int serve(const std::string& socketPath, const Options& defaults);
+
+/**
+ * the same protocol over a pair of streams, normally stdin / stdout, so one
+ * process can handle a continuous stream of images without temp files.
+ * responses are written in request order. path= requests work here as well.
+ *
+ * @param in Stream requests are read from, until EOF.
+ * @param out Stream responses are written to.
+ * @param defaults Detector tuning, verbosity and worker count used for every job.
+ * @return int Exit code, 0 when the input ended cleanly.
+ */
+int serveStream(std::FILE* in, std::FILE* out, const Options& defaults);
+
+} // namespace rotimage
@@ -0,0 +1,128 @@
+#include "stream.h"
+#include "hashing.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include <filesystem>
+#include <iostream>
+
+namespace rotimage {
+
+void setBinaryMode(std::FILE* file) {
+#ifdef _WIN32
+	_setmode(_fileno(file), _O_BINARY);
+#else
+	(void)file;
+#endif
+}
+
+bool readAllBytes(std::FILE* file, std::vector<uchar>& bytes) {
+	bytes.clear();
+	uchar buffer[64 * 1024];
+	size_t count;
+	while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		bytes.insert(bytes.end(), buffer, buffer + count);
+	}
+	return !std::ferror(file);
+}
+
+bool writeAllBytes(std::FILE* file, const std::vector<uchar>& bytes) {
+	if (!bytes.empty() && std::fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+		return false;
+	}
+	return std::fflush(file) == 0;
+}
+
+namespace {
+
+/**
+ * encodeImage(), with opencv's exceptions ( e.g. a float image as png ) reported as a failure like processFileStatus does.
+ */
+bool encodeOrReport(const std::string& extension, const cv::Mat& image, std::vector<uchar>& encoded, const std::vector<uchar>* original) {
+	try {
+		return encodeImage(extension, image, encoded, original);
+	}
+	catch (const cv::Exception& e) {
+		std::cerr << e.what() << std::endl;
+		return false;
+	}
+}
+
+} // namespace
+
+bool processPipe(const std::string& inputFile, const std::string& outputFile, const std::string& format, const Options& options) {
+	std::vector<uchar> encoded;
+	if (inputFile == "-") {
+		setBinaryMode(stdin);
+		if (!readAllBytes(stdin, encoded) || encoded.empty()) {
+			std::cerr << "Could not read an image from stdin" << std::endl;
+			return false;
+		}
+	}
+	else if (!readFileBytes(inputFile, encoded)) {
+		encoded.clear();
+	}
+
+	cv::Mat image;
+	if (!encoded.empty()) {
+		image = decodeImage(encoded, decodeFlags(options));
+	}
+	if (image.empty()) {
+		std::cerr << "Could not open or find the image: " << inputFile << std::endl;
+		return false;
+	}
+
+	// the encoded bytes are already in memory, so the angle cache costs just a hash
+	Deskewer deskewer(options);
+	double angle = 0.0;
+	cv::Mat rotatedImage = options.angleCache ? deskewer.process(image, hashBytes(encoded.data(), encoded.size()), &angle) : deskewer.process(image, &angle);
+	if (angle == 0.0) {
+		// already level, passed through so the other end of the pipe still gets an image
+		rotatedImage = image;
+	}
+	else if (rotatedImage.empty()) {
+		return false;
+	}
+
+	const std::vector<uchar>* original = options.stripMetadata ? nullptr : &encoded;
+	if (outputFile != "-") {
+		std::vector<uchar> result;
+		if (!encodeOrReport(std::filesystem::path(outputFile).extension().string(), rotatedImage, result, original)) {
+			std::cerr << "Failed to encode the image for: " << outputFile << std::endl;
+			return false;
+		}
+		if (!writeFileBytes(outputFile, result)) {
+			std::cerr << "Failed to write the image to: " << outputFile << std::endl;
+			return false;
+		}
+		if (options.verbose) {
+			std::cout << "Image rotated successfully and saved to " << outputFile << std::endl;
+		}
+		return true;
+	}
+
+	std::string extension = format;
+	if (extension.empty()) {
+		extension = inputFile != "-" ? std::filesystem::path(inputFile).extension().string() : "";
+	}
+	if (extension.empty()) {
+		extension = ".png";
+	}
+
+	std::vector<uchar> result;
+	if (!encodeOrReport(extension, rotatedImage, result, original)) {
+		std::cerr << "Failed to encode the image as " << extension << std::endl;
+		return false;
+	}
+	setBinaryMode(stdout);
+	if (!writeAllBytes(stdout, result)) {
+		std::cerr << "Failed to write the image to stdout" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+} // namespace rotimage
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "librotimage.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// piping encoded images through stdin / stdout instead of temp files
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+/**
+ * switch a stdio stream to binary, stops windows mangling image bytes.
+ *
+ * @param file stdin or stdout.
+ */
+void setBinaryMode(std::FILE* file);
+
+/**
+ * read a stream until EOF.
+ *
+ * @param file The stream to read.
+ * @param bytes Receives everything that was read.
+ * @return bool False on a read error.
+ */
+bool readAllBytes(std::FILE* file, std::vector<uchar>& bytes);
+
+/**
+ * write a buffer to a stream and flush it.
+ *
+ * @param file The stream to write.
+ * @param bytes What to write.
+ * @return bool False on a write error.
+ */
+bool writeAllBytes(std::FILE* file, const std::vector<uchar>& bytes);
+
+/**
+ * same as Deskewer::processFile, but either path can be "-" to read an encoded
+ * image from stdin or write one to stdout.
+ *
+ * @param inputFile The path of the input image file, or "-".
+ * @param outputFile The path where the output image will be saved, or "-".
+ * @param format Encoding used for stdout, e.g. ".png". empty uses the input extension, or .png.
+ * @param options Angle or detection and verbosity.
+ * @return bool Status code (true for success, false for error).
+ */
+bool processPipe(const std::string& inputFile, const std::string& outputFile, const std::string& format, const Options& options);
+
+} // namespace rotimage
@@ -0,0 +1,190 @@
+#include "watch.h"
+#include "scanner.h"
+
+#include <filesystem>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#endif
+
+namespace rotimage {
+
+#ifdef __linux__
+
+namespace {
+
+// files are only picked up once the writer is done with them
+const uint32_t fileEvents = IN_CLOSE_WRITE | IN_MOVED_TO;
+const uint32_t directoryEvents = IN_CREATE | IN_MOVED_TO;
+
+/**
+ * true if path is dir or somewhere below it, both already absolute and normal.
+ */
+bool isWithin(const std::filesystem::path& path, const std::filesystem::path& dir) {
+	auto mismatch = std::mismatch(dir.begin(), dir.end(), path.begin(), path.end());
+	return mismatch.first == dir.end();
+}
+
+class Watcher {
+public:
+	Watcher(const std::filesystem::path& outputDir, const Options& options) : outputDir(outputDir), options(options) {
+		fd = inotify_init1(IN_CLOEXEC);
+	}
+
+	~Watcher() {
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	bool valid() const {
+		return fd >= 0;
+	}
+
+	/**
+	 * watch dir, and everything below it when recursive.
+	 */
+	void add(const std::filesystem::path& dir) {
+		if (isWithin(dir, outputDir)) {
+			return;
+		}
+		int wd = inotify_add_watch(fd, dir.c_str(), fileEvents | directoryEvents | IN_ONLYDIR);
+		if (wd < 0) {
+			std::cerr << "Warning: Can't watch " << dir << ": " << strerror(errno) << std::endl;
+			return;
+		}
+		directories[wd] = dir;
+		if (options.verbose) {
+			std::cout << "Watching " << dir << std::endl;
+		}
+
+		if (!options.recursive) {
+			return;
+		}
+		std::error_code ec;
+		for (std::filesystem::directory_iterator iter(dir, ec), end; !ec && iter != end; iter.increment(ec)) {
+			if (iter->is_directory(ec)) {
+				add(iter->path());
+			}
+		}
+	}
+
+	/**
+	 * block for the next batch of events and hand every completed file to onFile,
+	 * the batch decides whether it's an image.
+	 *
+	 * @return bool False if reading the inotify descriptor failed.
+	 */
+	template <class OnFile>
+	bool poll(OnFile onFile) {
+		alignas(inotify_event) char buffer[64 * 1024];
+		ssize_t length = read(fd, buffer, sizeof(buffer));
+		if (length < 0) {
+			return errno == EINTR;
+		}
+
+		for (char* pos = buffer; pos < buffer + length; ) {
+			const inotify_event* event = (const inotify_event*)pos;
+			pos += sizeof(inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				std::cerr << "Warning: inotify queue overflowed, some files may have been missed" << std::endl;
+				continue;
+			}
+			if (event->mask & IN_IGNORED) {
+				directories.erase(event->wd);
+				continue;
+			}
+
+			auto dir = directories.find(event->wd);
+			if (dir == directories.end() || event->len == 0) {
+				continue;
+			}
+			std::filesystem::path path = dir->second / event->name;
+
+			if (event->mask & IN_ISDIR) {
+				if (options.recursive && !isWithin(path, outputDir)) {
+					// a whole folder moved in, or files written before the watch was in place,
+					// no event comes for any of those. watched first so nothing falls in between,
+					// a file still being written may then be seen by both and is simply done twice
+					add(path);
+					scanDirectory(path, true, outputDir, [&](const std::filesystem::path& file) {
+						onFile(file);
+						return true;
+					});
+				}
+			}
+			else if (event->mask & fileEvents) {
+				onFile(path);
+			}
+		}
+		return true;
+	}
+
+private:
+	int fd = -1;
+	std::map<int, std::filesystem::path> directories;
+	std::filesystem::path outputDir;
+	const Options& options;
+};
+
+} // namespace
+
+
+int watchDirectory(const std::string& inputDir, const std::string& outputDir, const Options& options) {
+	std::error_code ec;
+	auto inputRoot = std::filesystem::weakly_canonical(inputDir, ec);
+	auto outputRoot = std::filesystem::weakly_canonical(outputDir, ec);
+
+	// every output would trigger another event
+	if (isWithin(inputRoot, outputRoot)) {
+		std::cerr << "The output directory can't be the watched directory or contain it: " << outputDir << std::endl;
+		return 1;
+	}
+
+	Watcher watcher(outputRoot, options);
+	if (!watcher.valid()) {
+		std::cerr << "Failed to initialise inotify: " << strerror(errno) << std::endl;
+		return 1;
+	}
+
+	// watch first, so nothing landing during the catch up pass is missed
+	watcher.add(inputRoot);
+
+	// the events go through the same batch as the catch up pass, with its manifest, journal,
+	// retries and failure list. paths under the canonical root so both agree on relative paths
+	bool ok = processDirectory(inputRoot.string(), outputRoot.string(), options, nullptr, [&](const std::function<bool(const std::filesystem::path&)>& onFile) {
+		bool stopped = false;
+		while (!stopped) {
+			bool polled = watcher.poll([&](const std::filesystem::path& path) {
+				if (!stopped && !onFile(path)) {
+					stopped = true;
+				}
+			});
+			if (!polled) {
+				std::cerr << "Failed to read inotify events: " << strerror(errno) << std::endl;
+				return false;
+			}
+		}
+		// --fail-fast
+		return true;
+	});
+	return ok ? 0 : 1;
+}
+
+#else
+
+int watchDirectory(const std::string& inputDir, const std::string& outputDir, const Options& options) {
+	(void)inputDir; (void)outputDir; (void)options;
+	std::cerr << "--watch needs inotify and is only supported on linux" << std::endl;
+	return 1;
+}
+
+#endif
+
+} // namespace rotimage
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "librotimage.h"
+#include <string>
+
+/////////////////////////////////////////////////////////////////////////////////
+/// watch folder mode, picks up files as they land in a drop directory instead
+/// of rescanning the whole tree from cron.
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace rotimage {
+
+/**
+ * process everything already in inputDir with processDirectory, then keep
+ * watching it ( and its subdirectories with options.recursive ) and queue each
+ * image to the same batch as soon as it has been completely written or moved
+ * in, so the manifest, journal, retries and failure list cover it as well.
+ * runs until the process is stopped, or an image fails with options.failFast.
+ * linux only, uses inotify.
+ *
+ * @param inputDir The directory to watch.
+ * @param outputDir The output directory path, changes inside it are ignored.
+ * @param options The same as for processDirectory.
+ * @return int Exit code, only returns on error.
+ */
+int watchDirectory(const std::string& inputDir, const std::string& outputDir, const Options& options);
+
+} // namespace rotimage
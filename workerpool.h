@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace rotimage {
+
+/**
+ * fixed size pool of worker threads fed from a single job queue. the threads
+ * are started once and stay warm for the life of the pool.
+ */
+class WorkerPool {
+public:
+	/**
+	 * @param threads Number of workers, 0 for one per core.
+	 * @param maxQueued Make submit() block once this many jobs are waiting, 0 for no limit.
+	 */
+	explicit WorkerPool(size_t threads = 0, size_t maxQueued = 0) : maxQueued(maxQueued) {
+		if (threads == 0) {
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		for (size_t i = 0; i < threads; i++) {
+			workers.emplace_back([this] { run(); });
+		}
+	}
+
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		available.notify_all();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	/**
+	 * queue a job for the next free worker.
+	 *
+	 * @param job Callable taking no arguments.
+	 * @return std::future Receives the result ( or exception ) of the job.
+	 */
+	template <class Job>
+	auto submit(Job&& job) -> std::future<decltype(job())> {
+		// packaged_task is move only, std::function wants something copyable
+		auto task = std::make_shared<std::packaged_task<decltype(job())()>>(std::forward<Job>(job));
+		auto result = task->get_future();
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			space.wait(lock, [this] { return maxQueued == 0 || jobs.size() < maxQueued; });
+			jobs.emplace([task] { (*task)(); });
+		}
+		available.notify_one();
+		return result;
+	}
+
+	/**
+	 * block until the queue is empty and every worker is idle.
+	 */
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this] { return jobs.empty() && busy == 0; });
+	}
+
+	size_t size() const {
+		return workers.size();
+	}
+
+private:
+	void run() {
+		for (;;) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				available.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (jobs.empty()) {
+					return;
+				}
+				job = std::move(jobs.front());
+				jobs.pop();
+				busy++;
+			}
+			space.notify_one();
+
+			job();
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				busy--;
+				if (jobs.empty() && busy == 0) {
+					idle.notify_all();
+				}
+			}
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable available;
+	std::condition_variable idle;
+	std::condition_variable space;
+	size_t maxQueued;
+	size_t busy = 0;
+	bool stopping = false;
+};
+
+} // namespace rotimage